@@ -0,0 +1,219 @@
+/*
+ * keyframe_bench: times KeyframeTrack::sample against per-bone glm
+ * interpolation on a synthetic rig, and checks that the SIMD kernels
+ * (polynomial acos, Taylor sin) agree with glm.
+ *
+ * Built once per kernel width, see bench/CMakeLists.txt:
+ *      keyframe_bench_scalar, keyframe_bench_sse, keyframe_bench_avx2
+ *
+ * Usage: keyframe_bench [bones] [keyframes] [samples]
+ *
+ * Two glm paths are timed:
+ *      old squad  the per-bone glm::slerp + boneSquad of the original
+ *                 Skeleton::samplePose, the baseline the track replaced
+ *      glm squad  glm::intermediate tangents and glm::squad per bone, the
+ *                 curve the track evaluates, used as the accuracy reference
+ */
+#include "bone_geometry.h"
+#include "keyframe_track.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+namespace {
+
+#if defined(KEYFRAME_TRACK_SCALAR)
+const char* kKernel = "scalar";
+#elif defined(__AVX2__)
+const char* kKernel = "avx2";
+#elif defined(__SSE2__) || defined(_M_X64)
+const char* kKernel = "sse";
+#else
+const char* kKernel = "scalar";
+#endif
+
+// Largest component error, up to the sign of the quaternion.
+float quatError(const glm::fquat& a, const glm::fquat& b)
+{
+	float plus = 0.0f, minus = 0.0f;
+	for (int c = 0; c < 4; ++c) {
+		plus = std::max(plus, std::abs(a[c] - b[c]));
+		minus = std::max(minus, std::abs(a[c] + b[c]));
+	}
+	return std::min(plus, minus);
+}
+
+// Segment of keyframes containing t and the position in it, -1 outside of
+// the keyed range.
+int findSegment(const std::vector<KeyFrame>& keyframes, float t, float& tau)
+{
+	auto iter = std::upper_bound(keyframes.begin(), keyframes.end(), t,
+			[](float time, const KeyFrame& k) { return time < k.time; });
+	int cur = int(iter - keyframes.begin()) - 1;
+	if (cur < 0 || cur + 1 >= int(keyframes.size()))
+		return -1;
+	float length = keyframes[cur + 1].time - keyframes[cur].time;
+	tau = length > 0.0f ? (t - keyframes[cur].time) / length : 0.0f;
+	return cur;
+}
+
+// KeyFrame::boneSquad before the track existed.
+glm::fquat boneSquad(glm::fquat prev, glm::fquat cur, glm::fquat next, float tau)
+{
+	if (KeyFrame::quatEquals(prev, next) || KeyFrame::quatEquals(prev, cur))
+		return prev;
+	glm::fquat a = glm::intermediate(prev, cur, next);
+	glm::fquat b = glm::intermediate(a, cur, next);
+	return glm::squad(prev, cur, a, b, tau);
+}
+
+void sampleOldSquad(const std::vector<KeyFrame>& keyframes, float t,
+                    std::vector<glm::fquat>& result)
+{
+	float tau;
+	int cur = findSegment(keyframes, t, tau);
+	if (cur < 0) {
+		result = keyframes[t < keyframes[0].time ? 0 : keyframes.size() - 1].rel_rot;
+		return;
+	}
+	const KeyFrame& from = keyframes[cur];
+	const KeyFrame& to = keyframes[cur + 1];
+	for (size_t i = 0; i < from.rel_rot.size(); ++i) {
+		glm::fquat mid = glm::slerp(from.rel_rot[i], to.rel_rot[i], tau);
+		result[i] = boneSquad(from.rel_rot[i], mid, to.rel_rot[i], tau);
+	}
+}
+
+// Same curve as KeyframeTrack::build and sample, one bone at a time.
+void sampleGlmSquad(const std::vector<KeyFrame>& keyframes, float t,
+                    std::vector<glm::fquat>& result)
+{
+	float tau;
+	int cur = findSegment(keyframes, t, tau);
+	if (cur < 0) {
+		result = keyframes[t < keyframes[0].time ? 0 : keyframes.size() - 1].rel_rot;
+		return;
+	}
+	int last = int(keyframes.size()) - 1;
+	const KeyFrame& k0 = keyframes[std::max(cur - 1, 0)];
+	const KeyFrame& k1 = keyframes[cur];
+	const KeyFrame& k2 = keyframes[cur + 1];
+	const KeyFrame& k3 = keyframes[std::min(cur + 2, last)];
+	for (size_t i = 0; i < k1.rel_rot.size(); ++i) {
+		// neighbouring keys in the same hemisphere, like build()
+		glm::fquat q0 = k0.rel_rot[i];
+		glm::fquat q1 = k1.rel_rot[i];
+		if (glm::dot(q0, q1) < 0.0f)
+			q1 = -q1;
+		glm::fquat q2 = k2.rel_rot[i];
+		if (glm::dot(q1, q2) < 0.0f)
+			q2 = -q2;
+		glm::fquat q3 = k3.rel_rot[i];
+		if (glm::dot(q2, q3) < 0.0f)
+			q3 = -q3;
+		if (KeyFrame::quatEquals(q1, q2)) {
+			result[i] = glm::squad(q1, q2, q1, q2, tau);
+			continue;
+		}
+		glm::fquat s1 = glm::intermediate(q0, q1, q2);
+		glm::fquat s2 = glm::intermediate(q1, q2, q3);
+		result[i] = glm::squad(q1, q2, s1, s2, tau);
+	}
+}
+
+// Keyframes of a rig that sways every bone around its own axis, with a
+// few bones held still like an animator's unkeyed joints.
+std::vector<KeyFrame> makeKeyframes(int nbones, int nkeys)
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<glm::vec3> axes(nbones);
+	for (glm::vec3& axis : axes)
+		axis = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+	std::vector<KeyFrame> keyframes(nkeys);
+	for (int k = 0; k < nkeys; ++k) {
+		keyframes[k].time = float(k);
+		for (int i = 0; i < nbones; ++i) {
+			float angle = i % 16 == 0 ? 0.3f : 1.5f * unit(rng);
+			keyframes[k].rel_rot.push_back(glm::angleAxis(angle, axes[i]));
+		}
+	}
+	return keyframes;
+}
+
+template<typename Sampler>
+double timeSamples(const std::vector<float>& times, Sampler sampler,
+                   std::vector<glm::fquat>& result, float& checksum)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (float t : times) {
+		sampler(t);
+		checksum += result[result.size() / 2].w;
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::micro>(end - start).count() / times.size();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	int nbones = argc > 1 ? std::atoi(argv[1]) : 300;
+	int nkeys = argc > 2 ? std::atoi(argv[2]) : 32;
+	int nsamples = argc > 3 ? std::atoi(argv[3]) : 20000;
+	const float kTolerance = 1e-5f;
+	if (nbones <= 0 || nkeys < 2 || nsamples <= 0) {
+		std::fprintf(stderr, "Usage: %s [bones] [keyframes] [samples]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<KeyFrame> keyframes = makeKeyframes(nbones, nkeys);
+	KeyframeTrack track;
+	track.build(keyframes);
+	LaneBuffer scratch;
+	scratch.resize(track.getScratchSize());
+
+	// Sample times spread over the keyed range, in a scattered order so
+	// that the segment lookup is not always a cache hit.
+	std::vector<float> times(nsamples);
+	float duration = keyframes.back().time;
+	for (int s = 0; s < nsamples; ++s)
+		times[s] = duration * float((s * 7919L) % nsamples) / nsamples;
+
+	std::vector<glm::fquat> expected(nbones), actual(nbones);
+	float max_error = 0.0f;
+	for (float t : times) {
+		sampleGlmSquad(keyframes, t, expected);
+		track.sample(t, actual, scratch);
+		for (int i = 0; i < nbones; ++i)
+			max_error = std::max(max_error, quatError(expected[i], actual[i]));
+	}
+
+	float checksum = 0.0f;
+	double old_us = timeSamples(times,
+			[&](float t) { sampleOldSquad(keyframes, t, expected); },
+			expected, checksum);
+	double glm_us = timeSamples(times,
+			[&](float t) { sampleGlmSquad(keyframes, t, expected); },
+			expected, checksum);
+	double track_us = timeSamples(times,
+			[&](float t) { track.sample(t, actual, scratch); },
+			actual, checksum);
+
+	std::printf("%d bones, %d keyframes, %d samples, %s kernels\n",
+	            nbones, nkeys, nsamples, kKernel);
+	std::printf("  old squad  %9.3f us/pose\n", old_us);
+	std::printf("  glm squad  %9.3f us/pose\n", glm_us);
+	std::printf("  track      %9.3f us/pose  (%.1fx old squad, %.1fx glm squad)\n",
+	            track_us, old_us / track_us, glm_us / track_us);
+	std::printf("  max error against glm squad %g (tolerance %g), checksum %g\n",
+	            max_error, kTolerance, checksum);
+	if (!(max_error <= kTolerance)) {
+		std::fprintf(stderr, "keyframe_bench: track disagrees with glm squad\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+# Width of the keyframe interpolation kernels in src/keyframe_track.cc.
+# SSE2 is always available on x86-64, AVX2 has to be asked for.
+OPTION(USE_AVX2 "Build the 8-wide AVX2 keyframe kernels" OFF)
+IF (USE_AVX2)
+	IF (MSVC)
+		set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} /arch:AVX2")
+	ELSE ()
+		set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -mavx2")
+	ENDIF ()
+	message(STATUS "AVX2 keyframe kernels enabled")
+ENDIF ()
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <exception>
 #include <unordered_map>
+#include <utility>
 
 using std::endl;
 
@@ -193,62 +194,113 @@ public:
 	}
 
 	void getJointWeights(std::vector<SparseTuple>& tup)
+	{
+		std::vector<JointWeights> weights;
+		getJointWeights(weights);
+		tup.clear();
+		tup.reserve(weights.size());
+		for (const auto& w : weights) {
+			// keep the two heaviest joints
+			float w0 = 1.0f;
+			if (w.ninfluences > 1)
+				w0 = w.weight[0] / (w.weight[0] + w.weight[1]);
+			tup.emplace_back(w.vid, w.jid[0], w.jid[1], w0);
+		}
+	}
+
+	void getJointWeights(std::vector<JointWeights>& weights)
 	{
 		constexpr int SKINNING_BDEF1 = mmd::Model::SkinningOperator::SKINNING_BDEF1;
 		constexpr int SKINNING_BDEF2 = mmd::Model::SkinningOperator::SKINNING_BDEF2;
 		constexpr int SKINNING_BDEF4 = mmd::Model::SkinningOperator::SKINNING_BDEF4;
 		constexpr int SKINNING_SDEF = mmd::Model::SkinningOperator::SKINNING_SDEF;
 		size_t nv = model_.GetVertexNum();
-		tup.clear();
-		tup.reserve(nv * 2);
+		weights.clear();
+		weights.reserve(nv);
 		for (size_t i = 0; i < nv; i++) {
-			const auto& v = model_.GetVertex(i);
-			int skt = v.GetSkinningOperator().GetSkinningType();
+			const auto& op = model_.GetVertex(i).GetSkinningOperator();
+			JointWeights w;
+			w.vid = int(i);
+			w.ninfluences = 0;
 
-			switch (skt) {
+			switch (op.GetSkinningType()) {
 				case SKINNING_BDEF1:
-					{
-						const auto& bdef1 = v.GetSkinningOperator().GetBDEF1();
-						auto bid = pmd_bone_to_useful_bone_[bdef1.GetBoneID()];
-						if (bid >= 0)
-							tup.emplace_back(i, bid, -1, 1.0f);
-					}
+					addInfluence(w, op.GetBDEF1().GetBoneID(), 1.0f);
 					break;
 				case SKINNING_BDEF2:
 					{
-						const auto& bdef2 = v.GetSkinningOperator().GetBDEF2();
-						auto bid0 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(0)];
-						auto bid1 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(1)];
-						if (bid0 >= 0 && bid1 >= 0) {
-							tup.emplace_back(i, bid0, bid1, bdef2.GetBoneWeight());
-						}
+						const auto& bdef2 = op.GetBDEF2();
+						addInfluence(w, bdef2.GetBoneID(0), bdef2.GetBoneWeight());
+						addInfluence(w, bdef2.GetBoneID(1), 1.0f - bdef2.GetBoneWeight());
 					}
 					break;
 				case SKINNING_BDEF4:
 					{
-						std::cerr << "We are limited to models that each vertex only binds to at most two bones " << std::endl;
-						throw -1;
-						break;
-#if 0
-						const auto& bdef4 = v.GetSkinningOperator().GetBDEF4();
-						for (int i = 0 ; i < 4; i++) {
-							auto bid = pmd_bone_to_useful_bone_[bdef4.GetBoneID(i)];
-							if (bid < 0)
-								continue;
-							tup.emplace_back(bid, i, bdef4.GetBoneWeight(i));
-						}
-#endif
+						const auto& bdef4 = op.GetBDEF4();
+						for (int k = 0; k < 4; k++)
+							addInfluence(w, bdef4.GetBoneID(k), bdef4.GetBoneWeight(k));
 					}
 					break;
 				case SKINNING_SDEF:
-					std::cerr << "Unexcepted SkinningOperator " << v.GetSkinningOperator().GetSkinningType() << std::endl;
-					throw -1;
+					{
+						// blended like BDEF2, without the spherical
+						// correction
+						const auto& sdef = op.GetSDEF();
+						addInfluence(w, sdef.GetBoneID(0), sdef.GetBoneWeight());
+						addInfluence(w, sdef.GetBoneID(1), 1.0f - sdef.GetBoneWeight());
+					}
 					break;
+				default:
+					std::cerr << "Unexcepted SkinningOperator " << op.GetSkinningType() << std::endl;
+					throw -1;
 			}
-			//std::cerr << bdef2.GetBoneID(0) << "\t" << bdef2.GetBoneID(1) << "\t" << bdef2.GetBoneWeight() << endl;
+			if (normalizeInfluences(w))
+				weights.push_back(w);
 		}
 	}
 private:
+	// Influences on bones that were not kept (see open) are dropped, the
+	// remaining ones get their weight back in normalizeInfluences.
+	void addInfluence(JointWeights& w, size_t pmd_bone, float weight)
+	{
+		if (weight <= 0.0f)
+			return;
+		int bid = pmd_bone_to_useful_bone_[int(pmd_bone)];
+		if (bid < 0)
+			return;
+		for (int k = 0; k < w.ninfluences; k++) {
+			if (w.jid[k] == bid) {
+				w.weight[k] += weight;
+				return;
+			}
+		}
+		w.jid[w.ninfluences] = bid;
+		w.weight[w.ninfluences] = weight;
+		w.ninfluences++;
+	}
+
+	bool normalizeInfluences(JointWeights& w)
+	{
+		// insertion sort, heaviest first
+		for (int k = 1; k < w.ninfluences; k++)
+			for (int j = k; j > 0 && w.weight[j] > w.weight[j - 1]; j--) {
+				std::swap(w.jid[j], w.jid[j - 1]);
+				std::swap(w.weight[j], w.weight[j - 1]);
+			}
+		float sum = 0.0f;
+		for (int k = 0; k < w.ninfluences; k++)
+			sum += w.weight[k];
+		if (sum <= 0.0f)
+			return false;
+		for (int k = 0; k < w.ninfluences; k++)
+			w.weight[k] /= sum;
+		for (int k = w.ninfluences; k < JointWeights::kMaxInfluences; k++) {
+			w.jid[k] = -1;
+			w.weight[k] = 0.0f;
+		}
+		return true;
+	}
+
 	mmd::Model model_;
 	std::unordered_map<int, int> useful_bone_to_pmd_bone_, pmd_bone_to_useful_bone_;
 };
@@ -289,3 +341,8 @@ void MMDReader::getJointWeights(std::vector<SparseTuple>& tup)
 {
 	d_->getJointWeights(tup);
 }
+
+void MMDReader::getJointWeights(std::vector<JointWeights>& weights)
+{
+	d_->getJointWeights(weights);
+}
@@ -23,6 +23,19 @@ struct SparseTuple {
 	}
 };
 
+/*
+ * All joint influences of one vertex, up to four (BDEF4).
+ * Influences are sorted by decreasing weight and their weights add up to
+ * one. Unused entries have jid -1 and weight 0.
+ */
+struct JointWeights {
+	static const int kMaxInfluences = 4;
+	int vid;
+	int jid[kMaxInfluences];
+	float weight[kMaxInfluences];
+	int ninfluences;
+};
+
 class MMDReader {
 public:
 	MMDReader();
@@ -84,6 +97,18 @@ public:
 	 *       reading another weight from VRAM.
 	 */
 	void getJointWeights(std::vector<SparseTuple>& tup);
+	/*
+	 * Same, keeping every influence of BDEF4 vertices.
+	 * Output:
+	 *      weights: one JointWeights per vertex that has at least one
+	 *               influence, vertices without one are left out.
+	 *
+	 * Note: the SparseTuple version reduces BDEF4 vertices to their two
+	 *       heaviest joints.
+	 *       SDEF vertices are read as BDEF2 of the same two joints, the
+	 *       C/R0/R1 parameters are ignored as mmd's own Poser does.
+	 */
+	void getJointWeights(std::vector<JointWeights>& weights);
 private:
 	std::unique_ptr<MMDAdapter> d_;
 };
@@ -0,0 +1,50 @@
+#include "alloc_counter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+
+namespace {
+	std::atomic<size_t> heap_allocations(0);
+}
+
+void* operator new(std::size_t size)
+{
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (size == 0)
+		size = 1;
+	void* ptr = std::malloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+size_t heapAllocationCount()
+{
+	return heap_allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+size_t heapAllocationCount()
+{
+	return 0;
+}
+
+#endif
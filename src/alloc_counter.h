@@ -0,0 +1,16 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstddef>
+
+/*
+ * Number of global operator new calls so far.
+ *
+ * Debug builds replace the global allocation functions to count them, which
+ * lets the main loop assert that steady state pose evaluation never touches
+ * the heap. Release builds (NDEBUG) leave the allocator alone and always
+ * return 0.
+ */
+size_t heapAllocationCount();
+
+#endif
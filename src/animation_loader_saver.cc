@@ -1,6 +1,7 @@
 #include "gui.h"
 #include "texture_to_render.h"
 #include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <glm/gtx/io.hpp>
 #include <unordered_map>
@@ -59,15 +60,13 @@ void GUI::saveAnimationTo(const std::string& fn)
 	file << js;
 }
 
-void GUI::loadAnimationFrom(const std::string& fn)
+namespace {
+
+void readModelKeyframes(json& j, Mesh& mesh)
 {
-	// FIXME: Load keyframes from json file.
-	ifstream ifs(fn);
-	json j = json::parse(ifs);
+	Skeleton& skeleton = mesh.skeleton;
 	int num_keyframes = j["model_size"];
 	int num_bones = j["bones"];
-	int num_light_keyframes = j["light_size"];
-	int num_camera_keyframes = j["camera_size"];
 
 	for (int i = 0; i < num_keyframes; ++i) {
 		KeyFrame k;
@@ -82,9 +81,33 @@ void GUI::loadAnimationFrom(const std::string& fn)
 			k.rel_rot.push_back(quat);
 		}
 		k.time = j["model_time"+to_string(i)];
-		mesh_->skeleton.keyframes.push_back(k);
+		skeleton.keyframes.push_back(k);
 
 	}
+	// Skeleton::samplePose binary searches keyframes by time
+	std::stable_sort(skeleton.keyframes.begin(), skeleton.keyframes.end(),
+			[](const KeyFrame& a, const KeyFrame& b) { return a.time < b.time; });
+	mesh.rebuildTrack();
+}
+
+}
+
+void loadModelKeyframes(const std::string& fn, Mesh& mesh)
+{
+	ifstream ifs(fn);
+	json j = json::parse(ifs);
+	readModelKeyframes(j, mesh);
+}
+
+void GUI::loadAnimationFrom(const std::string& fn)
+{
+	// FIXME: Load keyframes from json file.
+	ifstream ifs(fn);
+	json j = json::parse(ifs);
+	int num_light_keyframes = j["light_size"];
+	int num_camera_keyframes = j["camera_size"];
+
+	readModelKeyframes(j, *mesh_);
 	for (int i = 0; i< num_light_keyframes; ++i){
 		LightKeyFrame lk;
 		json light = j["light_pos"+to_string(i)];
@@ -106,4 +129,5 @@ void GUI::loadAnimationFrom(const std::string& fn)
 
 	sceneState->end_light_keyframe = lightKeyframes.size() - 1;
 	sceneState->end_camera_keyframe = cameraKeyframes.size() - 1;
+	scene_keyframe_version_++;
 }
@@ -0,0 +1,265 @@
+#include "bone_bvh.h"
+#include "bone_geometry.h"
+#include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float kRadius2 = kCylinderRadius * kCylinderRadius;
+const float kMiss = std::numeric_limits<float>::max();
+
+// Slab test against the part of the ray in front of t_max, t_enter is
+// where the ray enters the box.
+bool hitBox(const glm::vec3& lo, const glm::vec3& hi,
+            const glm::vec3& origin, const glm::vec3& inv_dir, float t_max,
+            float& t_enter)
+{
+	float t0 = 0.0f, t1 = t_max;
+	for (int i = 0; i < 3; ++i) {
+		float near = (lo[i] - origin[i]) * inv_dir[i];
+		float far = (hi[i] - origin[i]) * inv_dir[i];
+		if (near > far)
+			std::swap(near, far);
+		t0 = std::max(t0, near);
+		t1 = std::min(t1, far);
+	}
+	t_enter = t0;
+	return t0 <= t1;
+}
+
+/*
+ * Ray against capsule a-b, with rd normalized. The ray first meets the
+ * infinite cylinder around a-b, within the segment that is the answer,
+ * otherwise the sphere at the end it fell beyond. Returns kMiss if the
+ * ray does not touch the capsule.
+ */
+#if !(defined(__SSE2__) || defined(_M_X64))
+float intersectCapsule(const glm::vec3& ro, const glm::vec3& rd,
+                       const glm::vec3& a, const glm::vec3& b)
+{
+	glm::vec3 ba = b - a;
+	glm::vec3 oa = ro - a;
+	float baba = glm::dot(ba, ba);
+	float bard = glm::dot(ba, rd);
+	float baoa = glm::dot(ba, oa);
+	float rdoa = glm::dot(rd, oa);
+	float oaoa = glm::dot(oa, oa);
+	float qa = baba - bard * bard;
+	float qb = baba * rdoa - baoa * bard;
+	float qc = baba * oaoa - baoa * baoa - kRadius2 * baba;
+	float h = qb * qb - qa * qc;
+	if (h < 0.0f)
+		return kMiss;
+	float t = (-qb - std::sqrt(h)) / qa;
+	float y = baoa + t * bard;
+	if (y > 0.0f && y < baba)
+		return t;
+	glm::vec3 oc = y <= 0.0f ? oa : ro - b;
+	float cb = glm::dot(rd, oc);
+	float ch = cb * cb - (glm::dot(oc, oc) - kRadius2);
+	if (ch <= 0.0f)
+		return kMiss;
+	return -cb - std::sqrt(ch);
+}
+#endif
+
+}
+
+void BoneBvh::build(const Skeleton& skeleton)
+{
+	nodes_.clear();
+	packets_.clear();
+	std::vector<int> bones;
+	std::vector<glm::vec3> centers(skeleton.joints.size());
+	for (const Joint& j : skeleton.joints) {
+		if (j.parent_index < 0)
+			continue;
+		bones.push_back(j.joint_index);
+		centers[j.joint_index] = 0.5f * (skeleton.jointPosition(j.joint_index)
+		                               + skeleton.jointPosition(j.parent_index));
+	}
+	if (bones.empty())
+		return;
+	buildNode(bones, 0, int(bones.size()), centers);
+	refit(skeleton);
+}
+
+int BoneBvh::buildNode(std::vector<int>& bones, int begin, int end,
+                       const std::vector<glm::vec3>& centers)
+{
+	int index = int(nodes_.size());
+	nodes_.emplace_back();
+	int n = end - begin;
+	if (n <= kLeafSize) {
+		Packet p;
+		for (int k = 0; k < kLeafSize; ++k)
+			p.bone[k] = k < n ? bones[begin + k] : -1;
+		nodes_[index].packet = int(packets_.size());
+		packets_.push_back(p);
+		return index;
+	}
+
+	// Median split along the widest axis of the centers, rounded so that
+	// the leaves on the left are full.
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (int i = begin; i < end; ++i) {
+		lo = glm::min(lo, centers[bones[i]]);
+		hi = glm::max(hi, centers[bones[i]]);
+	}
+	glm::vec3 extent = hi - lo;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+	                               : (extent.y > extent.z ? 1 : 2);
+	int nleaves = (n + kLeafSize - 1) / kLeafSize;
+	int mid = begin + nleaves / 2 * kLeafSize;
+	std::nth_element(bones.begin() + begin, bones.begin() + mid, bones.begin() + end,
+			[&centers, axis](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+	buildNode(bones, begin, mid, centers);
+	int right = buildNode(bones, mid, end, centers);
+	nodes_[index].right = right;
+	return index;
+}
+
+void BoneBvh::refit(const Skeleton& skeleton)
+{
+	for (Packet& p : packets_) {
+		for (int k = 0; k < kLeafSize; ++k) {
+			// unused lanes repeat the first capsule
+			int bone = p.bone[k] < 0 ? p.bone[0] : p.bone[k];
+			glm::vec3 a = skeleton.jointPosition(skeleton.joints[bone].parent_index);
+			glm::vec3 b = skeleton.jointPosition(bone);
+			p.ax[k] = a.x; p.ay[k] = a.y; p.az[k] = a.z;
+			p.bx[k] = b.x; p.by[k] = b.y; p.bz[k] = b.z;
+		}
+	}
+	// children come after their parent
+	glm::vec3 radius(kCylinderRadius);
+	for (int i = int(nodes_.size()) - 1; i >= 0; --i) {
+		Node& node = nodes_[i];
+		if (node.packet >= 0) {
+			const Packet& p = packets_[node.packet];
+			glm::vec3 lo(std::numeric_limits<float>::max());
+			glm::vec3 hi(-std::numeric_limits<float>::max());
+			for (int k = 0; k < kLeafSize; ++k) {
+				glm::vec3 a(p.ax[k], p.ay[k], p.az[k]);
+				glm::vec3 b(p.bx[k], p.by[k], p.bz[k]);
+				lo = glm::min(lo, glm::min(a, b));
+				hi = glm::max(hi, glm::max(a, b));
+			}
+			node.lo = lo - radius;
+			node.hi = hi + radius;
+		} else {
+			const Node& left = nodes_[i + 1];
+			const Node& right = nodes_[node.right];
+			node.lo = glm::min(left.lo, right.lo);
+			node.hi = glm::max(left.hi, right.hi);
+		}
+	}
+}
+
+BoneHit BoneBvh::intersect(const BoneRay& ray) const
+{
+	BoneHit hit;
+	float len = glm::length(ray.direction);
+	if (nodes_.empty() || len == 0.0f)
+		return hit;
+	const glm::vec3& ro = ray.origin;
+	glm::vec3 rd = ray.direction / len;
+	glm::vec3 inv_dir(1.0f / rd.x, 1.0f / rd.y, 1.0f / rd.z);
+	float best = std::numeric_limits<float>::max();
+
+#if defined(__SSE2__) || defined(_M_X64)
+	const __m128 r2 = _mm_set1_ps(kRadius2);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 rdx = _mm_set1_ps(rd.x), rdy = _mm_set1_ps(rd.y), rdz = _mm_set1_ps(rd.z);
+#endif
+
+	// tree depth is log2 of the number of leaves
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const Node& node = nodes_[index];
+		float t_enter;
+		if (!hitBox(node.lo, node.hi, ro, inv_dir, best, t_enter))
+			continue;
+		if (node.packet < 0) {
+			stack[top++] = node.right;
+			stack[top++] = index + 1;
+			continue;
+		}
+		const Packet& p = packets_[node.packet];
+		// Start the ray at the leaf, the quadratics below lose too much
+		// precision for a camera far from the bones.
+		glm::vec3 start = ro + t_enter * rd;
+		float t[kLeafSize];
+#if defined(__SSE2__) || defined(_M_X64)
+		__m128 rox = _mm_set1_ps(start.x), roy = _mm_set1_ps(start.y), roz = _mm_set1_ps(start.z);
+		// Four capsules per register, see intersectCapsule for the
+		// scalar version of the same math.
+		__m128 ax = _mm_loadu_ps(p.ax), ay = _mm_loadu_ps(p.ay), az = _mm_loadu_ps(p.az);
+		__m128 bx = _mm_loadu_ps(p.bx), by = _mm_loadu_ps(p.by), bz = _mm_loadu_ps(p.bz);
+		__m128 bax = _mm_sub_ps(bx, ax), bay = _mm_sub_ps(by, ay), baz = _mm_sub_ps(bz, az);
+		__m128 oax = _mm_sub_ps(rox, ax), oay = _mm_sub_ps(roy, ay), oaz = _mm_sub_ps(roz, az);
+#define DOT3(x0, y0, z0, x1, y1, z1) \
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, x1), _mm_mul_ps(y0, y1)), _mm_mul_ps(z0, z1))
+		__m128 baba = DOT3(bax, bay, baz, bax, bay, baz);
+		__m128 bard = DOT3(bax, bay, baz, rdx, rdy, rdz);
+		__m128 baoa = DOT3(bax, bay, baz, oax, oay, oaz);
+		__m128 rdoa = DOT3(rdx, rdy, rdz, oax, oay, oaz);
+		__m128 oaoa = DOT3(oax, oay, oaz, oax, oay, oaz);
+		__m128 qa = _mm_sub_ps(baba, _mm_mul_ps(bard, bard));
+		__m128 qb = _mm_sub_ps(_mm_mul_ps(baba, rdoa), _mm_mul_ps(baoa, bard));
+		__m128 qc = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(baba, oaoa), _mm_mul_ps(baoa, baoa)),
+		                       _mm_mul_ps(r2, baba));
+		__m128 h = _mm_sub_ps(_mm_mul_ps(qb, qb), _mm_mul_ps(qa, qc));
+		__m128 body_t = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, qb), _mm_sqrt_ps(_mm_max_ps(h, zero))), qa);
+		__m128 y = _mm_add_ps(baoa, _mm_mul_ps(body_t, bard));
+		__m128 in_body = _mm_and_ps(_mm_cmpgt_ps(y, zero), _mm_cmplt_ps(y, baba));
+		// sphere at the end the body hit fell beyond
+		__m128 at_a = _mm_cmple_ps(y, zero);
+		__m128 ocx = _mm_or_ps(_mm_and_ps(at_a, oax), _mm_andnot_ps(at_a, _mm_sub_ps(rox, bx)));
+		__m128 ocy = _mm_or_ps(_mm_and_ps(at_a, oay), _mm_andnot_ps(at_a, _mm_sub_ps(roy, by)));
+		__m128 ocz = _mm_or_ps(_mm_and_ps(at_a, oaz), _mm_andnot_ps(at_a, _mm_sub_ps(roz, bz)));
+		__m128 cb = DOT3(rdx, rdy, rdz, ocx, ocy, ocz);
+		__m128 ch = _mm_sub_ps(_mm_mul_ps(cb, cb), _mm_sub_ps(DOT3(ocx, ocy, ocz, ocx, ocy, ocz), r2));
+		__m128 cap_t = _mm_sub_ps(_mm_sub_ps(zero, cb), _mm_sqrt_ps(_mm_max_ps(ch, zero)));
+		__m128 in_cap = _mm_cmpgt_ps(ch, zero);
+#undef DOT3
+		__m128 tv = _mm_or_ps(_mm_and_ps(in_body, body_t), _mm_andnot_ps(in_body, cap_t));
+		__m128 hit_mask = _mm_and_ps(_mm_cmpge_ps(h, zero), _mm_or_ps(in_body, in_cap));
+		tv = _mm_or_ps(_mm_and_ps(hit_mask, tv), _mm_andnot_ps(hit_mask, _mm_set1_ps(kMiss)));
+		_mm_storeu_ps(t, tv);
+#else
+		for (int k = 0; k < kLeafSize; ++k)
+			t[k] = intersectCapsule(start, rd,
+					glm::vec3(p.ax[k], p.ay[k], p.az[k]),
+					glm::vec3(p.bx[k], p.by[k], p.bz[k]));
+#endif
+		for (int k = 0; k < kLeafSize; ++k) {
+			// a capsule may start before the box of its leaf
+			float t_bone = t_enter + t[k];
+			if (p.bone[k] >= 0 && t_bone > 0.0f && t_bone < best) {
+				best = t_bone;
+				hit.bone = p.bone[k];
+			}
+		}
+	}
+	if (hit.bone >= 0)
+		hit.t = best;
+	return hit;
+}
+
+void BoneBvh::intersect(const std::vector<BoneRay>& rays, std::vector<BoneHit>& hits) const
+{
+	hits.resize(rays.size());
+	for (size_t i = 0; i < rays.size(); ++i)
+		hits[i] = intersect(rays[i]);
+}
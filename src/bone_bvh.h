@@ -0,0 +1,68 @@
+#ifndef BONE_BVH_H
+#define BONE_BVH_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+struct Skeleton;
+
+struct BoneRay {
+	glm::vec3 origin;
+	glm::vec3 direction; // need not be normalized
+};
+
+struct BoneHit {
+	int bone = -1;  // joint index of the bone's child end, -1 on a miss
+	float t = 0.0f; // distance along the normalized ray direction
+};
+
+/*
+ * BoneBvh: bounding volume hierarchy over the bone capsules of a skeleton,
+ * for picking bones with rays.
+ *
+ * Every joint with a parent is one capsule of radius kCylinderRadius from
+ * the parent's position to its own. The tree only depends on the
+ * skeleton's topology: build() lays it out once, refit() moves the
+ * capsules to the current pose and recomputes the boxes bottom up.
+ *
+ * Leaves hold up to four capsules in SoA form, which the SSE kernel tests
+ * against a ray at once.
+ */
+class BoneBvh {
+public:
+	void build(const Skeleton& skeleton);
+	// Call after Skeleton::update() changed joint positions.
+	void refit(const Skeleton& skeleton);
+
+	// Closest capsule hit by the ray in front of its origin.
+	BoneHit intersect(const BoneRay& ray) const;
+	// One query per ray, hits[i] belongs to rays[i].
+	void intersect(const std::vector<BoneRay>& rays, std::vector<BoneHit>& hits) const;
+
+	bool empty() const { return nodes_.empty(); }
+private:
+	static const int kLeafSize = 4;
+
+	// Capsules of one leaf, unused lanes have bone -1.
+	struct Packet {
+		float ax[kLeafSize], ay[kLeafSize], az[kLeafSize];
+		float bx[kLeafSize], by[kLeafSize], bz[kLeafSize];
+		int bone[kLeafSize];
+	};
+
+	// Nodes are in preorder, an inner node's left child follows it and
+	// right is the index of the other one. Leaves have packet >= 0.
+	struct Node {
+		glm::vec3 lo, hi;
+		int right = -1;
+		int packet = -1;
+	};
+
+	int buildNode(std::vector<int>& bones, int begin, int end,
+	              const std::vector<glm::vec3>& centers);
+
+	std::vector<Node> nodes_;
+	std::vector<Packet> packets_;
+};
+
+#endif
@@ -2,9 +2,12 @@
 #include "bone_geometry.h"
 #include "texture_to_render.h"
 #include <fstream>
+#include <algorithm>
 #include <queue>
+#include <map>
 #include <iostream>
 #include <stdexcept>
+#include <cassert>
 #include <glm/gtx/io.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -49,12 +52,148 @@ void Skeleton::refreshCache(Configuration* target)
 	target->rot.resize(joints.size());
 	target->trans.resize(joints.size());
 	for (size_t i = 0; i < joints.size(); i++) {
-		target->rot[i] = glm::quat_cast(glm::mat3(joints[i].d));
-		target->trans[i] = joints[i].position;
+		target->rot[i] = glm::quat_cast(glm::mat3(worldTransform(i)));
+		target->trans[i] = jointPosition(i);
 
 	}
 }
 
+void Skeleton::refreshCache(Configuration* target, SlotRange slots)
+{
+	if (target == nullptr)
+		target = &cache;
+	target->rot.resize(joints.size());
+	target->trans.resize(joints.size());
+	for (int s = slots.begin; s < slots.end; ++s) {
+		int i = joint_[s];
+		target->rot[i] = glm::quat_cast(glm::mat3(world_[s]));
+		target->trans[i] = position_[s];
+	}
+}
+
+void Skeleton::flatten()
+{
+	int n = int(joints.size());
+	std::vector<int> roots;
+	for (Joint& j : joints)
+		j.children.clear();
+	for (Joint& j : joints) {
+		if (j.parent_index < 0) {
+			j.init_rel_position = j.init_position;
+			roots.push_back(j.joint_index);
+		} else {
+			j.init_rel_position = j.init_position - joints[j.parent_index].init_position;
+			joints[j.parent_index].children.push_back(j.joint_index);
+		}
+	}
+
+	// Depth first preorder with an explicit stack, children keep their
+	// PMD order.
+	slot_.resize(n);
+	joint_.clear();
+	std::vector<int> stack(roots.rbegin(), roots.rend());
+	while (!stack.empty()) {
+		int id = stack.back();
+		stack.pop_back();
+		slot_[id] = int(joint_.size());
+		joint_.push_back(id);
+		const std::vector<int>& children = joints[id].children;
+		stack.insert(stack.end(), children.rbegin(), children.rend());
+	}
+
+	parent_.resize(n);
+	end_.resize(n);
+	bind_.resize(n);
+	local_.assign(n, glm::mat4(1.0f));
+	world_.resize(n);
+	position_.resize(n);
+	inverse_bind_.resize(n);
+	for (int s = 0; s < n; ++s) {
+		const Joint& j = joints[joint_[s]];
+		parent_[s] = j.parent_index < 0 ? -1 : slot_[j.parent_index];
+		end_[s] = s + 1;
+		bind_[s] = j.init_rel_position;
+		// the bind pose is a constant of the model, invert it once
+		inverse_bind_[s] = glm::inverse(glm::translate(j.init_position));
+	}
+	// children come after their parent, so one backwards sweep closes
+	// every subtree
+	for (int s = n - 1; s >= 0; --s)
+		if (parent_[s] >= 0)
+			end_[parent_[s]] = std::max(end_[parent_[s]], end_[s]);
+	dirty_ = SlotRange{0, n};
+}
+
+void Skeleton::updateSlots(int begin, int end)
+{
+	for (int s = begin; s < end; ++s) {
+		// translate(bind) * local only adds the bind offset to the
+		// translation column of an affine local transform
+		glm::mat4 m = local_[s];
+		m[3] += glm::vec4(bind_[s], 0.0f);
+		int p = parent_[s];
+		world_[s] = p < 0 ? m : world_[p] * m;
+		position_[s] = glm::vec3(world_[s][3]);
+	}
+}
+
+void Skeleton::rotate(int joint, const glm::mat4& R)
+{
+	if (joint < 0)
+		return;
+	int s = slot_[joint];
+	local_[s] = local_[s] * R;
+	dirty_.merge(SlotRange{s, end_[s]});
+}
+
+void Skeleton::translate(const glm::mat4& T)
+{
+	if (joints.empty())
+		return;
+	int s = slot_[0];
+	local_[s] = local_[s] * T;
+	dirty_.merge(SlotRange{s, end_[s]});
+}
+
+void Skeleton::setPose(const KeyFrame& k)
+{
+	int n = int(joint_.size());
+	for (int s = 0; s < n; ++s)
+		local_[s] = glm::toMat4(k.rel_rot[joint_[s]]);
+	dirty_ = SlotRange{0, n};
+}
+
+SlotRange Skeleton::update()
+{
+	SlotRange updated = dirty_;
+	updateSlots(updated.begin, updated.end);
+	dirty_ = SlotRange();
+	if (!updated.empty())
+		pose_version_++;
+	return updated;
+}
+
+int Skeleton::findKeyframe(float t) const
+{
+	auto iter = std::upper_bound(keyframes.begin(), keyframes.end(), t,
+			[](float time, const KeyFrame& k) { return time < k.time; });
+	return int(iter - keyframes.begin()) - 1;
+}
+
+void Skeleton::rebuildTrack()
+{
+	track.build(keyframes);
+	keyframe_version_++;
+}
+
+void Skeleton::samplePose(float t, KeyFrame& result, LaneBuffer& scratch) const
+{
+	// a stale track would silently play the previous animation
+	assert(track.getNumberOfKeyframes() == (int)keyframes.size());
+	result.time = t;
+	// holds the first/last pose outside of the keyed range
+	track.sample(t, result.rel_rot, scratch);
+}
 
 Mesh::Mesh()
 {
@@ -71,18 +210,36 @@ void Mesh::loadPmd(const std::string& fn)
 	mr.getMesh(vertices, faces, vertex_normals, uv_coordinates);
 	computeBounds();
 	mr.getMaterial(materials);
+	groupMaterialsByTexture();
 
 	// FIXME: load skeleton and blend weights from PMD file,
 	//        initialize std::vectors for the vertex attributes,
 	//        also initialize the skeleton as needed
 
-	vector<SparseTuple> weights;
+	vector<JointWeights> weights;
 	mr.getJointWeights(weights);
-	for (int i = 0; i < (int)weights.size(); ++i) {
-		SparseTuple current = weights[i];
-		joint0.push_back(current.jid0);
-		joint1.push_back(current.jid1);
-		weight_for_joint0.push_back(current.weight0);
+	// vertices without any influence follow the root
+	size_t nv = vertices.size();
+	joint0.assign(nv, 0);
+	joint1.assign(nv, -1);
+	weight_for_joint0.assign(nv, 1.0f);
+	bool four = false;
+	for (const JointWeights& w : weights)
+		four = four || w.ninfluences > 2;
+	if (four) {
+		joints4.assign(nv, glm::ivec4(0, -1, -1, -1));
+		weights4.assign(nv, glm::vec4(1.0f, 0.0f, 0.0f, 0.0f));
+	}
+	for (const JointWeights& w : weights) {
+		int v = w.vid;
+		joint0[v] = w.jid[0];
+		joint1[v] = w.jid[1];
+		if (w.ninfluences > 1)
+			weight_for_joint0[v] = w.weight[0] / (w.weight[0] + w.weight[1]);
+		if (four) {
+			joints4[v] = glm::ivec4(w.jid[0], w.jid[1], w.jid[2], w.jid[3]);
+			weights4[v] = glm::vec4(w.weight[0], w.weight[1], w.weight[2], w.weight[3]);
+		}
 	}
 
 	int id = 0;
@@ -93,6 +250,26 @@ void Mesh::loadPmd(const std::string& fn)
 		skeleton.add_joint(j);
 		++id;
 	}
+	skeleton.flatten();
+	// the palette is in slot order
+	for (size_t i = 0; i < joint0.size(); ++i) {
+		joint0[i] = skeleton.slotOf(joint0[i]);
+		if (joint1[i] >= 0)
+			joint1[i] = skeleton.slotOf(joint1[i]);
+	}
+	for (glm::ivec4& j : joints4)
+		for (int k = 0; k < 4; ++k)
+			if (j[k] >= 0)
+				j[k] = skeleton.slotOf(j[k]);
+
+	// Size the per-frame buffers up front so that evaluating a pose
+	// later on never has to grow them.
+	pose_.rel_rot.resize(getNumberOfBones());
+	track_scratch_.resize(KeyframeTrack::getScratchSize(getNumberOfBones()));
+	palette_.resize(getNumberOfBones());
+	dq_palette_.resize(getNumberOfBones());
+	updatePose();
+	skeleton.refreshCache();
 
 }
 
@@ -101,6 +278,41 @@ int Mesh::getNumberOfBones() const
 	return skeleton.joints.size();
 }
 
+/*
+ * Moves the materials (and their faces) that use the same texture next to
+ * each other, so that RenderPass draws each texture's faces in one call.
+ * The authored order is kept among the materials of one texture, which
+ * only matters for the transparent view.
+ */
+void Mesh::groupMaterialsByTexture()
+{
+	size_t covered = 0;
+	for (const Material& m : materials)
+		covered += m.nfaces;
+	if (covered != faces.size())
+		return;
+	// textures in order of first use
+	std::map<const Image*, size_t> rank;
+	for (const Material& m : materials)
+		rank.emplace(m.texture.get(), rank.size());
+	std::vector<Material> grouped(materials);
+	std::stable_sort(grouped.begin(), grouped.end(),
+			[&rank](const Material& a, const Material& b) {
+				return rank[a.texture.get()] < rank[b.texture.get()];
+			});
+	std::vector<glm::uvec3> grouped_faces;
+	grouped_faces.reserve(faces.size());
+	for (Material& m : grouped) {
+		size_t first = grouped_faces.size();
+		grouped_faces.insert(grouped_faces.end(),
+		                     faces.begin() + m.offset,
+		                     faces.begin() + m.offset + m.nfaces);
+		m.offset = first;
+	}
+	materials.swap(grouped);
+	faces.swap(grouped_faces);
+}
+
 void Mesh::computeBounds()
 {
 	bounds.min = glm::vec3(std::numeric_limits<float>::max());
@@ -114,119 +326,74 @@ void Mesh::computeBounds()
 
 
 void Mesh::updateAnimation(float t, AnimationState* a)
-{	// FIXME: Support Animation Here
+{
 	if(a == nullptr)
 		return;
 	if (t != -1 && skeleton.keyframes.size() > 0) {
-
 		a->current_time = t;
-		bool interpolate = true;
-		KeyFrame result;
-		if(a->current_time > a->old_time){
-			//forwards
-			float length = skeleton.keyframes[a->next_keyframe].time - skeleton.keyframes[a->current_keyframe].time;
-			
-			if (a->current_keyframe == a->end_keyframe || skeleton.keyframes[a->current_keyframe].time > a->current_time ){
-				//run out of keyframes or havent yet reached the first keyframe
-					interpolate = false;
-					if(skeleton.keyframes[a->current_keyframe].time > a->current_time){
-						//still not at the first keyframe, update the old time
-						a->old_time = a->current_time;
-					}
-
-			} else if (a->current_time - a->old_time > length) {
-				//time to switch frames
-				a->old_time = a->current_time;
-
-				if (a->next_keyframe < a->end_keyframe) {
-					//not at the end yet
-					a->prev_keyframe = a->current_keyframe;
-					a->current_keyframe = a->next_keyframe;
-					a->next_keyframe++;
-					interpolate = true;
-
-				} else {
-					a->prev_keyframe = a->current_keyframe;
-					a->current_keyframe = a->next_keyframe;
-				}
-			}
-			//calculate interpolation factor
-			float interp =  (a->current_time - a->old_time)/length;
-			
-			if (interpolate){
-				int cp1 = glm::clamp<int>(a->current_keyframe, 0, skeleton.keyframes.size() - 1);
-				int cp2 = glm::clamp<int>(a->next_keyframe, 0, skeleton.keyframes.size() - 1);
-				int cp3 = glm::clamp<int>(a->next_keyframe +1, 0, skeleton.keyframes.size() - 1);
-
-				KeyFrame::interpolate(skeleton.keyframes[cp1], skeleton.keyframes[cp2], skeleton.keyframes[cp3], interp, result);
-
-			} else {
-				result = skeleton.keyframes[a->current_keyframe];
-			}
-		} else {
-			//backwards wooo
-			//number of seconds to spend on the frame:
-			float length = skeleton.keyframes[a->current_keyframe].time - skeleton.keyframes[a->prev_keyframe].time;
-			if (a->current_keyframe == 0 ||  skeleton.keyframes[a->current_keyframe].time < a->current_time){
-				//run out of keyframes or havent yet reached the first keyframe
-					interpolate = false;
-					if( skeleton.keyframes[a->current_keyframe].time < a->current_time){
-						//still not at the first keyframe, update the old time
-						a->old_time = a->current_time;
-					}
-			} else if (a->old_time - a->current_time > length) {
-					//switch keyframes
-				a->old_time = a->current_time;
-
-				if (a->prev_keyframe > 0) {
-					a->next_keyframe = a->current_keyframe;
-					a->current_keyframe = a->prev_keyframe;
-					a->prev_keyframe--;
-					interpolate = true;
-
-				} else {
-					//no more frames prior to prev_keyframe
-					a->next_keyframe = a->current_keyframe;
-					a->current_keyframe = a->prev_keyframe;
-				}
-			}
-			//interpolation factor
-			float interp = (a->old_time - a->current_time)/length;
-			
-			if (interpolate){
-				int cp1 = glm::clamp<int>(a->current_keyframe, 0, skeleton.keyframes.size() - 1);
-				int cp2 = glm::clamp<int>(a->prev_keyframe, 0, skeleton.keyframes.size() - 1);
-				int cp3 = glm::clamp<int>(a->prev_keyframe-1, 0, skeleton.keyframes.size() - 1);
-
-				KeyFrame::interpolate(skeleton.keyframes[cp1], skeleton.keyframes[cp2], skeleton.keyframes[cp3], interp, result);
-
-			} else {
-				result = skeleton.keyframes[a->current_keyframe];
-			}
+		a->current_keyframe = skeleton.findKeyframe(t);
 
-		}
-		changeSkeleton(result);
+		skeleton.samplePose(t, pose_, track_scratch_);
+		changeSkeleton(pose_);
 	}
-	skeleton.refreshCache(&currentQ_);
+	updatePose();
+}
+
+void Mesh::rebuildTrack()
+{
+	skeleton.rebuildTrack();
+	// keyframes read from a file may have more bones than the model
+	size_t needed = skeleton.track.getScratchSize();
+	if (track_scratch_.size() < needed)
+		track_scratch_.resize(needed);
 }
 
 void Mesh::updateAnimation()
 {
-	skeleton.refreshCache(&currentQ_);
+	updatePose();
 }
 
-void Mesh::changeSkeleton(KeyFrame& k)
+void Mesh::updatePose()
 {
-	skeleton.joints[0].t = glm::toMat4(k.rel_rot[0]);
-	skeleton.joints[0].d = skeleton.joints[0].b * skeleton.joints[0].t;
-	skeleton.joints[0].position = glm::vec3(skeleton.joints[0].d * glm::vec4(0,0,0,1));
+	SlotRange changed = skeleton.update();
+	if (changed.empty())
+		return;
+	skeleton.refreshCache(&currentQ_, changed);
+	for (int s = changed.begin; s < changed.end; ++s)
+		palette_[s] = skeleton.slotWorldTransform(s) * skeleton.slotInverseBind(s);
+	if (skinning_mode_ == kDualQuaternionSkinning)
+		updateDualQuaternions(changed);
+	palette_changed_.merge(changed);
+}
 
-	for (int i = 1; i < getNumberOfBones(); ++i) {
-		skeleton.joints[i].t = glm::toMat4(k.rel_rot[i]);
-		skeleton.joints[i].d = skeleton.joints[skeleton.joints[i].parent_index].d * skeleton.joints[i].b * skeleton.joints[i].t;
-		skeleton.joints[i].position = glm::vec3(skeleton.joints[i].d * glm::vec4(0,0,0,1));
+void Mesh::updateDualQuaternions(SlotRange slots)
+{
+	for (int s = slots.begin; s < slots.end; ++s) {
+		// palette matrices are rigid, split them into q and t and
+		// build the dual part 0.5 * t * q
+		glm::fquat q = glm::quat_cast(glm::mat3(palette_[s]));
+		glm::fquat t(0.0f, glm::vec3(palette_[s][3]));
+		glm::fquat d = 0.5f * (t * q);
+		dq_palette_[s][0] = glm::vec4(q.x, q.y, q.z, q.w);
+		dq_palette_[s][1] = glm::vec4(d.x, d.y, d.z, d.w);
 	}
 }
+
+void Mesh::setSkinningMode(SkinningMode mode)
+{
+	if (mode == skinning_mode_)
+		return;
+	skinning_mode_ = mode;
+	SlotRange all{0, int(palette_.size())};
+	if (mode == kDualQuaternionSkinning)
+		updateDualQuaternions(all);
+	palette_changed_.merge(all);
+}
+
+void Mesh::changeSkeleton(KeyFrame& k)
+{
+	skeleton.setPose(k);
+}
 const Configuration*
 Mesh::getCurrentQ() const
 {
@@ -10,6 +10,7 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <mmdadapter.h>
+#include "keyframe_track.h"
 #include <iostream>
 #include <chrono>
 
@@ -29,14 +30,12 @@ struct Joint {
 	Joint()
 		: joint_index(-1),
 		  parent_index(-1),
-		  position(glm::vec3(0.0f)),
 		  init_position(glm::vec3(0.0f))
 	{
 	}
 	Joint(int id, glm::vec3 wcoord, int parent)
 		: joint_index(id),
 		  parent_index(parent),
-		  position(wcoord),
 		  init_position(wcoord),
 		  init_rel_position(init_position)
 	{
@@ -44,16 +43,12 @@ struct Joint {
 
 	int joint_index;
 	int parent_index;
-	glm::vec3 position;             // position of the joint
 	glm::fquat orientation;         // rotation w.r.t. initial configuration
 	glm::fquat rel_orientation;     // rotation w.r.t. it's parent. Used for animation.
 	glm::vec3 init_position;        // initial position of this joint
 	glm::vec3 init_rel_position;    // initial relative position to its parent
-	//god help
-	glm::mat4 t;
-	glm::mat4 b;
-	glm::mat4 d;
 	std::vector<int> children;
+	// The posed transforms live in Skeleton, see Skeleton::worldTransform.
 };
 
 struct Configuration {
@@ -74,41 +69,18 @@ struct KeyFrame {
 	static bool quatEquals(glm::fquat a, glm::fquat b){
 		return abs(glm::dot(a,b)) > 1- 0.0001;
 	}
-	static glm::fquat boneSquad(glm::fquat prev, glm::fquat cur, glm::fquat next, float tau){
-		if( quatEquals(prev,next) || quatEquals(prev,cur)){
-			return prev;
-		}
-
-		 glm::fquat a = glm::intermediate(prev,cur,next);
-		 glm::fquat b = glm::intermediate(a,cur,next);
-		return glm::squad(prev,cur,a,b, tau);
-
-}
-	static void interpolate(const KeyFrame& from,
-	                        const KeyFrame& to, const KeyFrame& next,
-	                        float tau,
-	                        KeyFrame& target) {
-		for(int i = 0; i < (int)from.rel_rot.size(); ++i){
-			glm::fquat cur = glm::slerp(from.rel_rot[i], to.rel_rot[i], tau);
-			target.rel_rot.push_back(boneSquad(from.rel_rot[i],cur,to.rel_rot[i], tau));
-		}
-
-	}
 };
 
 
+/*
+ * Result of the last Mesh::updateAnimation call. Sampling itself keeps no
+ * state, this only tells the GUI where the scrubber is.
+ */
 struct AnimationState {
-	int current_keyframe;
-	int next_keyframe;
-	int prev_keyframe;
-
-	int end_keyframe;
-
+	int current_keyframe;   // last keyframe at or before current_time, -1 if none
 	float current_time;
-	float old_time;
 
-	AnimationState(): current_keyframe(0), next_keyframe(1), prev_keyframe(0) {}
-	
+	AnimationState(): current_keyframe(-1), current_time(0.0f) {}
 };
 
 struct LineMesh {
@@ -116,81 +88,119 @@ struct LineMesh {
 	std::vector<glm::uvec2> indices;
 };
 
+/*
+ * Half open range [begin, end) of Skeleton slots. Merging two ranges keeps
+ * everything between them, so the result stays a single linear pass.
+ */
+struct SlotRange {
+	int begin = 0;
+	int end = 0;
+
+	bool empty() const { return begin >= end; }
+	void merge(const SlotRange& other) {
+		if (other.empty())
+			return;
+		if (empty()) {
+			*this = other;
+			return;
+		}
+		begin = std::min(begin, other.begin);
+		end = std::max(end, other.end);
+	}
+};
+
 struct Skeleton {
 	std::vector<Joint> joints;
 	vector<KeyFrame> keyframes;
+	// SoA copy of keyframes used for sampling, call Mesh::rebuildTrack()
+	// after editing keyframes.
+	KeyframeTrack track;
 
 	Configuration cache;
 
 	void refreshCache(Configuration* cache = nullptr);
+	// Only refreshes the joints in the given slots.
+	void refreshCache(Configuration* cache, SlotRange slots);
 	const glm::vec3* collectJointTrans() const;
 	const glm::fquat* collectJointRot() const;
 
 	glm::vec3* jointTrans();
 	glm::fquat* jointRot();
 
-
-	// FIXME: create skeleton and bone data structures
-
-	void add_joint(Joint& j){
-			j.t = glm::mat4(1.0f);
-			if(j.joint_index > 0){
-
-				glm::vec3 temp = j.init_position - joints[j.parent_index].init_position;
-				j.init_rel_position = temp;
-				j.b = glm::mat4(1,0,0,0,0,1,0,0,0,0,1,0,temp[0],temp[1],temp[2],1);
-				j.d = joints[j.parent_index].d * j.b * j.t;
-			} else {
-					glm::vec3 temp = j.init_position;
-					j.b = glm::mat4(1,0,0,0,0,1,0,0,0,0,1,0,temp[0],temp[1],temp[2],1);
-					j.d = j.b * j.t;
-			}
-			joints.push_back(j);
-			// add current joint to parent's child list
-			if(j.parent_index >= 0){
-				joints[j.parent_index].children.push_back(j.joint_index);
-			}
-	}
-	void rotate(int index, int child, glm::mat4 R){
-		Joint& j = joints[index];
-		j.t = j.t * R;
-		if(index > 0){
-			j.d = joints[j.parent_index].d * j.b * j.t;
-		} else {
-			j.d = j.b * j.t;
-		}
-
-		update_d(child);
-
-	}
-	void translate(glm::mat4 T){
-		Joint& j = joints[0];
-		j.t = j.t * T;
-		update_d(0);
-	}
-	
-	void update_d(int index){
-		if(index < 0){
-			return;
-		}
-		Joint& j = joints[index];
-		if(index > 0){
-			j.d = joints[j.parent_index].d * j.b * j.t;
-		} else {
-			j.d = j.b * j.t;
-		}
-		j.position = glm::vec3(j.d * glm::vec4(0,0,0,1));
-		for(int child: j.children){
-			update_d(child);
-		}
-	}
+	// Index of the last keyframe at or before t, -1 if t precedes all of them.
+	int findKeyframe(float t) const;
+	void rebuildTrack();
+	// Interpolated pose at time t. Keeps no state, so any time can be
+	// sampled in O(log n) and from any thread that brings its own scratch.
+	void samplePose(float t, KeyFrame& result, LaneBuffer& scratch) const;
+
+
+	void add_joint(const Joint& j) { joints.push_back(j); }
+	// Called once all joints are added: links children, lays the joints
+	// out parent-before-child and resets them to the bind pose, which
+	// the next update() computes.
+	void flatten();
+
+	int slotOf(int joint) const { return slot_[joint]; }
+	int jointAt(int slot) const { return joint_[slot]; }
+
+	// Posed state of a joint, by joint index. World transforms and
+	// positions are as of the last update().
+	const glm::mat4& localTransform(int joint) const { return local_[slot_[joint]]; }
+	const glm::mat4& worldTransform(int joint) const { return world_[slot_[joint]]; }
+	const glm::vec3& jointPosition(int joint) const { return position_[slot_[joint]]; }
+	const glm::mat4& slotWorldTransform(int slot) const { return world_[slot]; }
+	// Inverse of the bind pose world transform, constant after flatten().
+	const glm::mat4& slotInverseBind(int slot) const { return inverse_bind_[slot]; }
+
+	// Edits only change local transforms and mark the affected subtree
+	// dirty, update() applies all of them in one pass.
+	// Post-multiplies the local transform of joint by R.
+	void rotate(int joint, const glm::mat4& R);
+	// Moves the whole model, applied to the root joint.
+	void translate(const glm::mat4& T);
+	// Sets every local rotation from k.
+	void setPose(const KeyFrame& k);
+	// Recomputes the dirty slots and returns them, empty if nothing was
+	// edited since the last call.
+	SlotRange update();
+	// Counts the update() calls that moved any joint.
+	unsigned getPoseVersion() const { return pose_version_; }
+	// Counts rebuildTrack() calls, which follow every keyframe edit.
+	unsigned getKeyframeVersion() const { return keyframe_version_; }
 
 	void getSkeletonKeyframeTimes(vector<float>& result) {
-		for (KeyFrame k: keyframes) {
+		for (const KeyFrame& k: keyframes) {
 			result.push_back(k.time);
 		}
 	}
 
+private:
+	// Recomputes world transforms of the slots [begin, end) in one pass.
+	void updateSlots(int begin, int end);
+
+	/*
+	 * Forward kinematics state, stored by slot instead of joint index.
+	 * Slots are in depth first preorder, so every parent comes before its
+	 * children and each subtree is the contiguous range [slot, end_[slot]).
+	 */
+	std::vector<int> slot_;             // joint index -> slot
+	std::vector<int> parent_;           // parent slot, -1 for roots
+	std::vector<int> end_;              // one past the last slot of the subtree
+	std::vector<int> joint_;            // slot -> joint index
+	std::vector<glm::vec3> bind_;       // offset from the parent in bind pose
+	std::vector<glm::mat4> inverse_bind_;
+	std::vector<glm::mat4> local_;      // local rotation (translation for the root)
+	std::vector<glm::mat4> world_;      // parent world * translate(bind) * local
+	std::vector<glm::vec3> position_;   // world space joint position
+	SlotRange dirty_;
+	unsigned pose_version_ = 0;
+	unsigned keyframe_version_ = 0;
+};
+
+enum SkinningMode {
+	kLinearBlendSkinning,
+	kDualQuaternionSkinning,
 };
 
 struct Mesh {
@@ -199,12 +209,19 @@ struct Mesh {
 	std::vector<glm::vec4> vertices;
 	/*
 	 * Static per-vertex attrributes for Shaders
+	 * joint0/joint1 index the skinning palette, i.e. they are Skeleton
+	 * slots rather than joint indices.
 	 */
 	std::vector<int32_t> joint0;
 	std::vector<int32_t> joint1;
 	std::vector<float> weight_for_joint0; // weight_for_joint1 can be calculated
-	std::vector<glm::vec3> vector_from_joint0;
-	std::vector<glm::vec3> vector_from_joint1;
+	/*
+	 * All influences of BDEF4 models, slots sorted by decreasing weight,
+	 * unused ones have weight 0. Empty unless some vertex has more than
+	 * two, joint0/joint1 hold the two heaviest of them either way.
+	 */
+	std::vector<glm::ivec4> joints4;
+	std::vector<glm::vec4> weights4;
 	std::vector<glm::vec4> vertex_normals;
 	std::vector<glm::vec4> face_normals;
 	std::vector<glm::vec2> uv_coordinates;
@@ -216,63 +233,63 @@ struct Mesh {
 
 	void loadPmd(const std::string& fn);
 	int getNumberOfBones() const;
+	bool hasFourInfluences() const { return !weights4.empty(); }
 	glm::vec3 getCenter() const { return 0.5f * glm::vec3(bounds.min + bounds.max); }
 	const Configuration* getCurrentQ() const; // Configuration is abbreviated as Q
 	void updateAnimation(float t,  AnimationState* a);
+	// Rebuilds skeleton.track after editing keyframes and grows the
+	// sampling scratch buffer if the track needs more.
+	void rebuildTrack();
 	void updateAnimation();
 
 	glm::vec3 lightSpline(float t);
 	glm::vec3 cameraPosSpline(float t);
 	glm::mat3 cameraRotSpline(float t);
 
-	vector<glm::mat4> load_d_u() {
-		vector<glm::mat4> u;
-		u.push_back(skeleton.joints[0].d * glm::inverse(skeleton.joints[0].b));
-
-		for (int bone = 1; bone < getNumberOfBones(); ++bone) {
-			u.push_back(skeleton.joints[bone].d*glm::inverse(glm::mat4(glm::vec4(1,0,0,0),glm::vec4(0,1,0,0),
-										glm::vec4(0,0,1,0),glm::vec4(skeleton.joints[bone].init_position,1))));
-		}
-
-		return u;
+	// Skinning palette in Skeleton slot order, kept up to date by
+	// updateAnimation. Every pass that skins reads this one buffer.
+	const vector<glm::mat4>& load_d_u() const { return palette_; }
+	// Palette entries changed since the last call, for partial uploads.
+	SlotRange takePaletteChanges() {
+		SlotRange changed = palette_changed_;
+		palette_changed_ = SlotRange();
+		return changed;
 	}
 
-	//sad attempt at dual quaternions
-	// vector<glm::mat2x4> load_dq() {
-	// 	vector<glm::mat2x4> dq;
-	// 	// const glm::vec3* collectJointTrans() const;
-	// 	// const glm::fquat* collectJointRot() const;
-
-	// 	for (int bone = 0; bone < getNumberOfBones(); ++bone) {
-	// 		//u.push_back(glm::inverse(skeleton.joints[bone-1].d * skeleton.joints[bone].b));
-	// 		// u.push_back(skeleton.joints[bone].d*glm::inverse(skeleton.joints[bone-1].d * skeleton.joints[bone].b));
-	// 		glm::vec3 trans = skeleton.joints[bone].position;
-	// 		glm::fquat rot = glm::quat_cast(glm::mat3(skeleton.joints[bone].d));
-
-	// 		glm::mat2x4 dq_mat;
-	// 		for (int i = 0; i < 4; i++) {
-	// 			dq_mat[0][i] = rot[i];
-	// 		}
-			
-	// 		dq_mat[1][0] = -0.5*(trans[0]*rot[1] + trans[1]*rot[2] + trans[2]*rot[3]);
-	// 		dq_mat[1][1] = 0.5*( trans[0]*rot[0] + trans[1]*rot[3] - trans[2]*rot[2]);
-	// 		dq_mat[1][2] = 0.5*(-trans[0]*rot[3] + trans[1]*rot[0] + trans[2]*rot[1]);
-	// 		dq_mat[1][3] = 0.5*( trans[0]*rot[2] - trans[1]*rot[1] + trans[2]*rot[0]);
-
-
-	// 		dq.push_back(dq_mat);
-	// 	}
-
-	// 	return dq;
-	// }
+	// Dual quaternion palette in slot order, column 0 is the rotation and
+	// column 1 the dual part. Only kept up to date in
+	// kDualQuaternionSkinning mode, load_d_u() is always up to date.
+	const vector<glm::mat2x4>& load_dq() const { return dq_palette_; }
+	SkinningMode getSkinningMode() const { return skinning_mode_; }
+	// Switching modes marks the whole palette as changed.
+	void setSkinningMode(SkinningMode mode);
+
 	//ADDED THIS, in .cc file
 	void changeSkeleton(KeyFrame& k);
 
 private:
 	void computeBounds();
 	void computeNormals();
+	// Makes the materials that share a texture adjacent, see loadPmd.
+	void groupMaterialsByTexture();
+	// Runs FK on the edited joints and refreshes what depends on them.
+	void updatePose();
+	void updateDualQuaternions(SlotRange slots);
 	Configuration currentQ_;
+
+	// Per-frame scratch buffers, sized in loadPmd (track_scratch_ again in
+	// rebuildTrack) so that playing never grows them.
+	KeyFrame pose_;
+	LaneBuffer track_scratch_;
+	std::vector<glm::mat4> palette_;
+	std::vector<glm::mat2x4> dq_palette_;
+	SlotRange palette_changed_;
+	SkinningMode skinning_mode_ = kLinearBlendSkinning;
 };
 
+// Reads the model keyframes of an animation saved by GUI::saveAnimationTo
+// into mesh.skeleton, ignoring the light and camera keyframes. Defined in
+// animation_loader_saver.cc.
+void loadModelKeyframes(const std::string& fn, Mesh& mesh);
 
 #endif
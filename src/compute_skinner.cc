@@ -0,0 +1,81 @@
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <iostream>
+#include <string>
+#include "compute_skinner.h"
+#include "gl_state.h"
+#include "palette_buffer.h"
+#include "skin_cache.h"
+#include "vertex_format.h"
+
+ComputeSkinner::ComputeSkinner(const char* compute_shader)
+{
+	if (!GLEW_VERSION_4_3) {
+		std::cerr << "GL 4.3 is not available, compute skinning is disabled" << std::endl;
+		return;
+	}
+	GLuint shader = 0;
+	CHECK_GL_ERROR(shader = glCreateShader(GL_COMPUTE_SHADER));
+	CHECK_GL_ERROR(glShaderSource(shader, 1, &compute_shader, nullptr));
+	glCompileShader(shader);
+	CHECK_GL_SHADER_ERROR(shader);
+	CHECK_GL_ERROR(program_ = glCreateProgram());
+	CHECK_GL_ERROR(glAttachShader(program_, shader));
+	glLinkProgram(program_);
+	CHECK_GL_PROGRAM_ERROR(program_);
+	CHECK_GL_ERROR(glDeleteShader(shader));
+
+	CHECK_GL_ERROR(nvertices_loc_ = glGetUniformLocation(program_, "nvertices"));
+	CHECK_GL_ERROR(stride_loc_ = glGetUniformLocation(program_, "stride"));
+	CHECK_GL_ERROR(wide_joints_loc_ = glGetUniformLocation(program_, "wide_joints"));
+	CHECK_GL_ERROR(four_influences_loc_ = glGetUniformLocation(program_, "four_influences"));
+	CHECK_GL_ERROR(dual_quaternion_loc_ = glGetUniformLocation(program_, "dual_quaternion"));
+}
+
+ComputeSkinner::~ComputeSkinner()
+{
+	if (bind_pose_)
+		glDeleteBuffers(1, &bind_pose_);
+	if (program_)
+		glDeleteProgram(program_);
+}
+
+void ComputeSkinner::setBindPose(const PackedSkinnedVertices& vertices)
+{
+	if (!program_)
+		return;
+	if (!bind_pose_)
+		CHECK_GL_ERROR(glGenBuffers(1, &bind_pose_));
+	nvertices_ = vertices.size();
+	// the vertex stride is a multiple of 4 bytes, see vertex_format.cc
+	stride_ = vertices.getStride() / sizeof(GLuint);
+	wide_joints_ = vertices.hasWideJoints();
+	four_influences_ = vertices.hasFourInfluences();
+	size_t bytes = vertices.getStride() * nvertices_;
+	CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, bind_pose_));
+	CHECK_GL_ERROR(glBufferData(GL_SHADER_STORAGE_BUFFER, bytes > 0 ? bytes : 4,
+	                            vertices.data(), GL_STATIC_DRAW));
+	CHECK_GL_ERROR(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void ComputeSkinner::dispatch(const PaletteBuffer& palette, SkinningMode mode, SkinCache& cache)
+{
+	if (!program_ || nvertices_ == 0)
+		return;
+	GLState::useProgram(program_);
+	CHECK_GL_ERROR(glUniform1ui(nvertices_loc_, GLuint(nvertices_)));
+	CHECK_GL_ERROR(glUniform1ui(stride_loc_, GLuint(stride_)));
+	CHECK_GL_ERROR(glUniform1i(wide_joints_loc_, wide_joints_));
+	CHECK_GL_ERROR(glUniform1i(four_influences_loc_, four_influences_));
+	CHECK_GL_ERROR(glUniform1i(dual_quaternion_loc_, mode == kDualQuaternionSkinning));
+	CHECK_GL_ERROR(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bind_pose_));
+	CHECK_GL_ERROR(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, palette.getBuffer()));
+	CHECK_GL_ERROR(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cache.getBuffer()));
+	CHECK_GL_ERROR(glDispatchCompute(GLuint((nvertices_ + kGroupSize - 1) / kGroupSize), 1, 1));
+	// the passes drawing the cache read it as vertex attributes, the
+	// skinning validation with glGetBufferSubData
+	CHECK_GL_ERROR(glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+	                               GL_BUFFER_UPDATE_BARRIER_BIT));
+	for (GLuint binding = 0; binding < 3; binding++)
+		CHECK_GL_ERROR(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0));
+}
@@ -0,0 +1,49 @@
+#ifndef COMPUTE_SKINNER_H
+#define COMPUTE_SKINNER_H
+
+#include <cstddef>
+#include "bone_geometry.h"
+
+class PackedSkinnedVertices;
+class PaletteBuffer;
+class SkinCache;
+
+/*
+ * ComputeSkinner: fills a SkinCache with a GL 4.3 compute shader, as an
+ * alternative to the transform feedback passes.
+ *
+ * The bind pose is a copy of the PackedSkinnedVertices in a storage
+ * buffer, the palette is the PaletteBuffer of the skinning mode bound as
+ * a storage buffer. The cost is one dispatch per pose no matter how many
+ * passes, or instances sharing the pose, draw the cache afterwards.
+ */
+class ComputeSkinner {
+public:
+	// Compiles compute_shader if the context supports GL 4.3.
+	explicit ComputeSkinner(const char* compute_shader);
+	~ComputeSkinner();
+	ComputeSkinner(const ComputeSkinner&) = delete;
+	ComputeSkinner& operator=(const ComputeSkinner&) = delete;
+
+	bool isSupported() const { return program_ != 0; }
+	void setBindPose(const PackedSkinnedVertices& vertices);
+	// Skins every vertex into cache, which must hold as many vertices as
+	// the bind pose. palette must match mode.
+	void dispatch(const PaletteBuffer& palette, SkinningMode mode, SkinCache& cache);
+private:
+	static const unsigned kGroupSize = 64; // local_size_x of skin.comp
+
+	unsigned program_ = 0;
+	unsigned bind_pose_ = 0;
+	size_t nvertices_ = 0;
+	size_t stride_ = 0;
+	bool wide_joints_ = false;
+	bool four_influences_ = false;
+	int nvertices_loc_ = -1;
+	int stride_loc_ = -1;
+	int wide_joints_loc_ = -1;
+	int four_influences_loc_ = -1;
+	int dual_quaternion_loc_ = -1;
+};
+
+#endif
@@ -6,7 +6,16 @@
  */
 
 const float kCylinderRadius = 0.25;
-const int kMaxBones = 128;
+// Texture units of the skinning palettes (samplerBuffer), unit 0 is used
+// by material textures.
+const int kPaletteTextureUnit = 1;
+const int kDualQuaternionTextureUnit = 2;
+// Material parameters and the material of every face (samplerBuffer and
+// isamplerBuffer), see RenderPass::renderMaterials.
+const int kMaterialTextureUnit = 3;
+const int kFaceMaterialTextureUnit = 4;
+// Uniform buffer binding point of the FrameConstants block.
+const int kFrameConstantsBinding = 0;
 /*
  * Extra credit: what would happen if you set kNear to 1e-5? How to solve it?
  */
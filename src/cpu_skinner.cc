@@ -0,0 +1,158 @@
+#include "cpu_skinner.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+/*
+ * One mat4 column per register, the scalar fallback has the same
+ * interface.
+ */
+#if defined(__SSE2__) || defined(_M_X64)
+typedef __m128 Column;
+inline Column load(const glm::vec4& v) { return _mm_loadu_ps(&v[0]); }
+inline void store(glm::vec4& v, Column c) { _mm_storeu_ps(&v[0], c); }
+inline Column splat(float f) { return _mm_set1_ps(f); }
+inline Column add(Column a, Column b) { return _mm_add_ps(a, b); }
+inline Column mul(Column a, Column b) { return _mm_mul_ps(a, b); }
+#else
+typedef glm::vec4 Column;
+inline Column load(const glm::vec4& v) { return v; }
+inline void store(glm::vec4& v, Column c) { v = c; }
+inline Column splat(float f) { return glm::vec4(f); }
+inline Column add(Column a, Column b) { return a + b; }
+inline Column mul(Column a, Column b) { return a * b; }
+#endif
+
+// Applies the blended matrix with columns c0 to c3 to the point v and the
+// direction n.
+inline void transform(Column c0, Column c1, Column c2, Column c3,
+                      const glm::vec4& v, const glm::vec4& n,
+                      glm::vec4& out_v, glm::vec4& out_n)
+{
+	store(out_v, add(add(mul(c0, splat(v.x)), mul(c1, splat(v.y))),
+	                 add(mul(c2, splat(v.z)), c3)));
+	store(out_n, add(add(mul(c0, splat(n.x)), mul(c1, splat(n.y))),
+	                 mul(c2, splat(n.z))));
+	// palette matrices are rigid, so no inverse transpose
+	float len = glm::length(glm::vec3(out_n));
+	out_n = len > 0.0f ? glm::vec4(glm::vec3(out_n) / len, 0.0f) : glm::vec4(0.0f);
+}
+
+// (w0 * A + (1 - w0) * B) applied to the point v and the direction n.
+inline void skinVertex(const glm::mat4& A, const glm::mat4& B, float w0,
+                       const glm::vec4& v, const glm::vec4& n,
+                       glm::vec4& out_v, glm::vec4& out_n)
+{
+	Column wa = splat(w0);
+	Column wb = splat(1.0f - w0);
+	transform(add(mul(load(A[0]), wa), mul(load(B[0]), wb)),
+	          add(mul(load(A[1]), wa), mul(load(B[1]), wb)),
+	          add(mul(load(A[2]), wa), mul(load(B[2]), wb)),
+	          add(mul(load(A[3]), wa), mul(load(B[3]), wb)),
+	          v, n, out_v, out_n);
+}
+
+// Same with up to four influences, see Mesh::joints4.
+inline void skinVertex(const std::vector<glm::mat4>& palette,
+                       const glm::ivec4& joints, const glm::vec4& weights,
+                       const glm::vec4& v, const glm::vec4& n,
+                       glm::vec4& out_v, glm::vec4& out_n)
+{
+	const glm::mat4& A = palette[joints[0]];
+	Column w = splat(weights[0]);
+	Column c0 = mul(load(A[0]), w);
+	Column c1 = mul(load(A[1]), w);
+	Column c2 = mul(load(A[2]), w);
+	Column c3 = mul(load(A[3]), w);
+	// weights are sorted, the first zero ends the used influences
+	for (int k = 1; k < 4 && weights[k] != 0.0f; ++k) {
+		const glm::mat4& B = palette[joints[k]];
+		w = splat(weights[k]);
+		c0 = add(c0, mul(load(B[0]), w));
+		c1 = add(c1, mul(load(B[1]), w));
+		c2 = add(c2, mul(load(B[2]), w));
+		c3 = add(c3, mul(load(B[3]), w));
+	}
+	transform(c0, c1, c2, c3, v, n, out_v, out_n);
+}
+
+}
+
+void CpuSkinner::skin(const Mesh& mesh)
+{
+	const std::vector<glm::mat4>& palette = mesh.load_d_u();
+	int n = int(mesh.vertices.size());
+	positions_.resize(n);
+	normals_.resize(n);
+	bool has_normals = mesh.vertex_normals.size() == mesh.vertices.size();
+	bool four = mesh.hasFourInfluences();
+
+	bounds_.min = glm::vec3(std::numeric_limits<float>::max());
+	bounds_.max = glm::vec3(-std::numeric_limits<float>::max());
+	// Each thread keeps its own bounds and merges them once at the end.
+#pragma omp parallel
+	{
+		glm::vec3 lo(std::numeric_limits<float>::max());
+		glm::vec3 hi(-std::numeric_limits<float>::max());
+#pragma omp for schedule(static)
+		for (int i = 0; i < n; ++i) {
+			glm::vec4 normal = has_normals ? mesh.vertex_normals[i] : glm::vec4(0.0f);
+			if (four) {
+				skinVertex(palette, mesh.joints4[i], mesh.weights4[i],
+				           mesh.vertices[i], normal,
+				           positions_[i], normals_[i]);
+			} else {
+				int jid0 = i < int(mesh.joint0.size()) ? mesh.joint0[i] : 0;
+				int jid1 = i < int(mesh.joint1.size()) ? mesh.joint1[i] : -1;
+				float w0 = i < int(mesh.weight_for_joint0.size()) ? mesh.weight_for_joint0[i] : 1.0f;
+				if (jid1 < 0) {
+					jid1 = jid0;
+					w0 = 1.0f;
+				}
+				skinVertex(palette[jid0], palette[jid1], w0,
+				           mesh.vertices[i], normal,
+				           positions_[i], normals_[i]);
+			}
+			lo = glm::min(lo, glm::vec3(positions_[i]));
+			hi = glm::max(hi, glm::vec3(positions_[i]));
+		}
+#pragma omp critical
+		{
+			bounds_.min = glm::min(bounds_.min, lo);
+			bounds_.max = glm::max(bounds_.max, hi);
+		}
+	}
+}
+
+bool CpuSkinner::saveObj(const Mesh& mesh, const std::string& fn) const
+{
+	std::ofstream file(fn);
+	if (!file)
+		return false;
+	file << "# skinned " << positions_.size() << " vertices, "
+	     << mesh.faces.size() << " faces\n";
+	for (const glm::vec4& v : positions_)
+		file << "v " << v.x << ' ' << v.y << ' ' << v.z << '\n';
+	for (const glm::vec4& vn : normals_)
+		file << "vn " << vn.x << ' ' << vn.y << ' ' << vn.z << '\n';
+	// PMD texture coordinates start at the top of the image, OBJ ones at
+	// the bottom.
+	for (size_t i = 0; i < positions_.size(); ++i) {
+		glm::vec2 uv = i < mesh.uv_coordinates.size() ? mesh.uv_coordinates[i] : glm::vec2(0.0f);
+		file << "vt " << uv.x << ' ' << 1.0f - uv.y << '\n';
+	}
+	for (const glm::uvec3& f : mesh.faces) {
+		file << 'f';
+		for (int k = 0; k < 3; ++k)
+			file << ' ' << f[k] + 1 << '/' << f[k] + 1 << '/' << f[k] + 1;
+		file << '\n';
+	}
+	return bool(file);
+}
@@ -0,0 +1,40 @@
+#ifndef CPU_SKINNER_H
+#define CPU_SKINNER_H
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+#include "bone_geometry.h"
+
+/*
+ * CpuSkinner: linear blend skinning of a Mesh on the CPU.
+ *
+ * Applies the palette of the current pose (Mesh::load_d_u) with
+ * joint0/joint1/weight_for_joint0, or joints4/weights4 on models with
+ * more influences, to the bind pose vertices and normals, the same math as
+ * skin_lbs.glsl and skin_lbs4.glsl. Vertices are split across OpenMP
+ * threads when the build has OpenMP, and each vertex is blended and
+ * transformed a matrix column per SSE register.
+ *
+ * Used for headless export of posed meshes, for skinned bounds and as a
+ * reference for the GPU skinning paths.
+ */
+class CpuSkinner {
+public:
+	void skin(const Mesh& mesh);
+
+	const std::vector<glm::vec4>& getPositions() const { return positions_; }
+	const std::vector<glm::vec4>& getNormals() const { return normals_; }
+	// Bounds of the skinned positions.
+	const BoundingBox& getBounds() const { return bounds_; }
+
+	// Writes the skinned mesh as Wavefront OBJ, returns false if the file
+	// could not be written.
+	bool saveObj(const Mesh& mesh, const std::string& fn) const;
+private:
+	std::vector<glm::vec4> positions_;
+	std::vector<glm::vec4> normals_;
+	BoundingBox bounds_;
+};
+
+#endif
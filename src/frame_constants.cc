@@ -0,0 +1,46 @@
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <iostream>
+#include <cstring>
+#include "frame_constants.h"
+#include "config.h"
+
+static_assert(sizeof(FrameConstants) == 176, "FrameConstants must match the std140 block");
+
+FrameConstantsBuffer::FrameConstantsBuffer()
+{
+}
+
+FrameConstantsBuffer::~FrameConstantsBuffer()
+{
+	if (buffer_)
+		glDeleteBuffers(1, &buffer_);
+}
+
+void FrameConstantsBuffer::update(const FrameConstants& constants)
+{
+	if (!buffer_) {
+		CHECK_GL_ERROR(glGenBuffers(1, &buffer_));
+		CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, buffer_));
+		CHECK_GL_ERROR(glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants),
+		                            &constants, GL_DYNAMIC_DRAW));
+		CHECK_GL_ERROR(glBindBufferBase(GL_UNIFORM_BUFFER, kFrameConstantsBinding, buffer_));
+		last_ = constants;
+		return;
+	}
+	// a still camera and light leave the buffer alone
+	if (std::memcmp(&constants, &last_, sizeof(FrameConstants)) == 0)
+		return;
+	last_ = constants;
+	CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, buffer_));
+	CHECK_GL_ERROR(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameConstants), &constants));
+}
+
+void FrameConstantsBuffer::bindBlock(unsigned program)
+{
+	GLuint block;
+	CHECK_GL_ERROR(block = glGetUniformBlockIndex(program, "FrameConstants"));
+	if (block == GL_INVALID_INDEX)
+		return;
+	CHECK_GL_ERROR(glUniformBlockBinding(program, block, kFrameConstantsBinding));
+}
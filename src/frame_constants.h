@@ -0,0 +1,42 @@
+#ifndef FRAME_CONSTANTS_H
+#define FRAME_CONSTANTS_H
+
+#include <glm/glm.hpp>
+
+/*
+ * FrameConstants: what every pass reads from the camera and the light, in
+ * the std140 layout of the FrameConstants block the shaders declare.
+ */
+struct FrameConstants {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 light_position;
+	glm::vec4 light_color;
+	glm::vec3 camera_position;
+	float padding = 0.0f; // std140 rounds the vec3 up to a vec4
+};
+
+/*
+ * FrameConstantsBuffer: the uniform buffer behind the FrameConstants
+ * block, bound to kFrameConstantsBinding. Written once per frame instead
+ * of setting the same uniforms in every program.
+ */
+class FrameConstantsBuffer {
+public:
+	FrameConstantsBuffer();
+	~FrameConstantsBuffer();
+	FrameConstantsBuffer(const FrameConstantsBuffer&) = delete;
+	FrameConstantsBuffer& operator=(const FrameConstantsBuffer&) = delete;
+
+	// Uploads the constants unless they equal the last ones.
+	void update(const FrameConstants& constants);
+
+	// Points the FrameConstants block of program at the buffer, programs
+	// without the block are left alone. GLSL 330 cannot do this itself.
+	static void bindBlock(unsigned program);
+private:
+	unsigned buffer_ = 0;
+	FrameConstants last_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <iostream>
+#include "gl_state.h"
+
+namespace {
+
+// Cached texture targets, index into State::textures.
+const int kTargets = 2;
+
+int targetIndex(unsigned target)
+{
+	switch (target) {
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_BUFFER: return 1;
+		default: return -1;
+	}
+}
+
+// ~0u is never a GL name, so it stands for "unknown".
+const unsigned kUnknown = ~0u;
+
+struct State {
+	unsigned program = kUnknown;
+	unsigned vao = kUnknown;
+	unsigned active_unit = kUnknown;
+	unsigned textures[GLState::kUnits][kTargets];
+	unsigned samplers[GLState::kUnits];
+
+	State() { reset(); }
+	void reset()
+	{
+		program = vao = active_unit = kUnknown;
+		for (int u = 0; u < GLState::kUnits; u++) {
+			for (int t = 0; t < kTargets; t++)
+				textures[u][t] = kUnknown;
+			samplers[u] = kUnknown;
+		}
+	}
+};
+
+State state;
+GLState::Counters frame, last_frame;
+
+// Returns true if the call has to be made, and records value.
+bool change(unsigned& cached, unsigned value)
+{
+	if (cached == value) {
+		frame.elided++;
+		return false;
+	}
+	cached = value;
+	frame.issued++;
+	return true;
+}
+
+void activate(unsigned unit)
+{
+	if (change(state.active_unit, unit))
+		CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + unit));
+}
+
+}
+
+void GLState::useProgram(unsigned program)
+{
+	if (change(state.program, program))
+		CHECK_GL_ERROR(glUseProgram(program));
+}
+
+void GLState::bindVertexArray(unsigned vao)
+{
+	if (change(state.vao, vao))
+		CHECK_GL_ERROR(glBindVertexArray(vao));
+}
+
+void GLState::bindTexture(unsigned unit, unsigned target, unsigned texture)
+{
+	// Callers go on to glTexImage2D and friends, which act on the active
+	// unit, so it moves even when the bind itself is elided.
+	activate(unit);
+	int t = targetIndex(target);
+	if (unit < unsigned(kUnits) && t >= 0 && state.textures[unit][t] == texture) {
+		frame.elided++;
+		return;
+	}
+	if (unit < unsigned(kUnits) && t >= 0)
+		state.textures[unit][t] = texture;
+	frame.issued++;
+	CHECK_GL_ERROR(glBindTexture(target, texture));
+}
+
+void GLState::bindSampler(unsigned unit, unsigned sampler)
+{
+	if (unit >= unsigned(kUnits)) {
+		frame.issued++;
+		CHECK_GL_ERROR(glBindSampler(unit, sampler));
+		return;
+	}
+	if (change(state.samplers[unit], sampler))
+		CHECK_GL_ERROR(glBindSampler(unit, sampler));
+}
+
+void GLState::forgetTexture(unsigned texture)
+{
+	for (int u = 0; u < kUnits; u++)
+		for (int t = 0; t < kTargets; t++)
+			if (state.textures[u][t] == texture)
+				state.textures[u][t] = 0;
+}
+
+void GLState::invalidate()
+{
+	state.reset();
+}
+
+void GLState::beginFrame()
+{
+	last_frame = frame;
+	frame = Counters();
+}
+
+const GLState::Counters& GLState::getLastFrame()
+{
+	return last_frame;
+}
@@ -0,0 +1,37 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+/*
+ * GLState: cache of the program, VAO, texture and sampler bindings, so
+ * that binding what is already bound costs no GL call. Only works if all
+ * code binds these through it; code that does not has to call
+ * invalidate() afterwards.
+ *
+ * Textures are cached for GL_TEXTURE_2D and GL_TEXTURE_BUFFER on the
+ * first kUnits units, other targets and units are always passed on.
+ */
+class GLState {
+public:
+	static const int kUnits = 16;
+
+	static void useProgram(unsigned program);
+	static void bindVertexArray(unsigned vao);
+	// Binds texture to target on unit, which becomes the active unit.
+	static void bindTexture(unsigned unit, unsigned target, unsigned texture);
+	static void bindSampler(unsigned unit, unsigned sampler);
+
+	// Call when deleting a texture, GL unbinds it and the name may come
+	// back for a new one.
+	static void forgetTexture(unsigned texture);
+	static void invalidate();
+
+	struct Counters {
+		unsigned issued = 0; // binds passed on to GL
+		unsigned elided = 0; // binds of what was already bound
+	};
+	// Starts counting a new frame.
+	static void beginFrame();
+	static const Counters& getLastFrame();
+};
+
+#endif
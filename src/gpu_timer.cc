@@ -0,0 +1,65 @@
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <iostream>
+#include "gpu_timer.h"
+
+GpuTimer::GpuTimer()
+{
+}
+
+GpuTimer::~GpuTimer()
+{
+	if (queries_[0])
+		glDeleteQueries(kQueries, queries_);
+}
+
+void GpuTimer::begin()
+{
+	if (!queries_[0])
+		CHECK_GL_ERROR(glGenQueries(kQueries, queries_));
+	// all queries in flight, skip this frame rather than wait
+	if (issued_ - collected_ == kQueries)
+		return;
+	CHECK_GL_ERROR(glBeginQuery(GL_TIME_ELAPSED, queries_[issued_ % kQueries]));
+}
+
+void GpuTimer::end()
+{
+	if (issued_ - collected_ == kQueries)
+		return;
+	CHECK_GL_ERROR(glEndQuery(GL_TIME_ELAPSED));
+	issued_++;
+}
+
+void GpuTimer::reset()
+{
+	// queries of the old work may still be in flight, drop them as
+	// they come back
+	discard_ = issued_;
+	total_ns_ = 0;
+	samples_ = 0;
+}
+
+bool GpuTimer::poll(double& mean_ms)
+{
+	bool window_done = false;
+	while (collected_ < issued_) {
+		unsigned query = queries_[collected_ % kQueries];
+		GLint available = 0;
+		CHECK_GL_ERROR(glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+		if (!available)
+			break;
+		GLuint64 ns = 0;
+		CHECK_GL_ERROR(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns));
+		if (collected_++ < discard_)
+			continue;
+		total_ns_ += ns;
+		if (++samples_ == kWindow) {
+			mean_ms = double(total_ns_) / samples_ * 1e-6;
+			total_ns_ = 0;
+			samples_ = 0;
+			window_done = true;
+		}
+	}
+	return window_done;
+}
@@ -0,0 +1,38 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <cstdint>
+
+/*
+ * GpuTimer: measures GPU time between begin() and end() with
+ * GL_TIME_ELAPSED queries. Results are read a few frames later, once they
+ * are available, so timing never stalls the pipeline.
+ */
+class GpuTimer {
+public:
+	GpuTimer();
+	~GpuTimer();
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	void begin();
+	void end();
+	// Drops pending and accumulated samples, e.g. when the timed work
+	// changes.
+	void reset();
+	// Collects finished queries. Returns true once every kWindow samples,
+	// with their mean in milliseconds.
+	bool poll(double& mean_ms);
+private:
+	static const int kQueries = 4;
+	static const int kWindow = 120;
+
+	unsigned queries_[kQueries] = {};
+	int issued_ = 0;    // queries started so far
+	int collected_ = 0; // queries read back so far
+	int discard_ = 0;   // queries issued before the last reset()
+	uint64_t total_ns_ = 0;
+	int samples_ = 0;
+};
+
+#endif
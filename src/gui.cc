@@ -162,6 +162,8 @@ void GUI::assignMesh(Mesh* mesh)
 {
 	mesh_ = mesh;
 	center_ = mesh_->getCenter();
+	bone_bvh_.build(mesh_->skeleton);
+	bvh_pose_version_ = mesh_->skeleton.getPoseVersion();
 }
 
 void GUI::computeColor(){
@@ -195,6 +197,8 @@ void GUI::computeColor(){
 
 void GUI::keyCallback(int key, int scancode, int action, int mods)
 {
+	// keys act on the bone under the cursor
+	processInput();
 #if 0
 	if (action != 2)
 		std::cerr << "Key: " << key << " action: " << action << std::endl;
@@ -223,7 +227,7 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 			roll_speed = roll_speed_;
 		// FIXME: actually roll the bone here
 		glm::mat4 r = glm::rotate(roll_speed, glm::normalize(mesh_->skeleton.joints[current_bone_].init_rel_position));
-		mesh_->skeleton.rotate(mesh_->skeleton.joints[current_bone_].parent_index, current_bone_, r);
+		mesh_->skeleton.rotate(mesh_->skeleton.joints[current_bone_].parent_index, r);
 		pose_changed_ = true;
 
 	} else if (key == GLFW_KEY_C && action != GLFW_RELEASE) {
@@ -241,23 +245,30 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 		current_bone_ %= mesh_->getNumberOfBones();
 	} else if (key == GLFW_KEY_T && action != GLFW_RELEASE) {
 		transparent_ = !transparent_;
+	} else if (key == GLFW_KEY_Q && action == GLFW_RELEASE) {
+		// toggle linear blend / dual quaternion skinning
+		dual_quaternion_ = !dual_quaternion_;
+	} else if (key == GLFW_KEY_G && action == GLFW_RELEASE) {
+		// toggle the geometry shader in the floor and model passes
+		geometry_shader_ = !geometry_shader_;
+	} else if (key == GLFW_KEY_B && action == GLFW_RELEASE) {
+		// toggle bone picking from the GPU ID buffer
+		gpu_picking_ = !gpu_picking_;
+	} else if (key == GLFW_KEY_K && action == GLFW_RELEASE) {
+		// cycle vertex shader / transform feedback / compute skinning
+		skinning_backend_ = SkinningBackend((skinning_backend_ + 1) % kNumSkinningBackends);
+	} else if (key == GLFW_KEY_X && action == GLFW_RELEASE) {
+		// compare the next skin cache with the CPU skinner
+		validate_skinning_ = true;
 
 	} else if (key == GLFW_KEY_F && (mods & GLFW_MOD_CONTROL)) {
 		if (action == GLFW_RELEASE) {
 			// delete model keyframe that scrubber is over
 			if(getNumKeyframes() > 0) {
-				if(state->current_time >= mesh_->skeleton.keyframes[state->current_keyframe].time){
-					//forwards
-					mesh_->skeleton.keyframes.erase(mesh_->skeleton.keyframes.begin() + state->current_keyframe);
-				}else {
-					mesh_->skeleton.keyframes.erase(mesh_->skeleton.keyframes.begin() + state->prev_keyframe);
-				}
+				int cur = std::max(mesh_->skeleton.findKeyframe(state->current_time), 0);
+				mesh_->skeleton.keyframes.erase(mesh_->skeleton.keyframes.begin() + cur);
+				mesh_->rebuildTrack();
 				//texture_locations.erase(texture_locations.begin() + selected_frame);
-				state->end_keyframe = mesh_->skeleton.keyframes.size()-1;
-				if(state->next_keyframe > state->end_keyframe) {
-					state->current_keyframe = state->end_keyframe;
-					state->next_keyframe = state->end_keyframe;
-				}
 			}
 		}		
 	} else if (key == GLFW_KEY_L && (mods & GLFW_MOD_CONTROL)) {
@@ -272,6 +283,7 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 				}
 				//texture_locations.erase(texture_locations.begin() + selected_frame);
 				sceneState->end_light_keyframe = lightKeyframes.size()-1;
+				scene_keyframe_version_++;
 				if(sceneState->next_light_keyframe > sceneState->end_light_keyframe) {
 					sceneState->current_light_keyframe = sceneState->end_light_keyframe;
 					sceneState->next_light_keyframe = sceneState->end_light_keyframe;
@@ -291,6 +303,7 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 				}
 				//texture_locations.erase(texture_locations.begin() + selected_frame);
 				sceneState->end_camera_keyframe = cameraKeyframes.size()-1;
+				scene_keyframe_version_++;
 				if(sceneState->next_camera_keyframe > sceneState->end_camera_keyframe) {
 					sceneState->current_camera_keyframe = sceneState->end_camera_keyframe;
 					sceneState->next_camera_keyframe = sceneState->end_camera_keyframe;
@@ -302,32 +315,20 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 		//create a keyframe
 		KeyFrame k;
 		for(int bone = 0; bone < mesh_->getNumberOfBones(); ++bone) {
-			k.rel_rot.push_back(glm::quat_cast(mesh_->skeleton.joints[bone].t));
+			k.rel_rot.push_back(glm::quat_cast(mesh_->skeleton.localTransform(bone)));
 		}
 		k.time = pause_time;
-		if (getNumKeyframes() == 0){
-			mesh_->skeleton.keyframes.push_back(k);
-			state->current_keyframe = 0;
+		vector<KeyFrame>& keyframes = mesh_->skeleton.keyframes;
+		int cur = mesh_->skeleton.findKeyframe(k.time);
+		if (cur >= 0 && k.time < keyframes[cur].time + 0.5) {
+			// replace the keyframe under the scrubber
+			keyframes[cur] = k;
 		} else {
-			float current_keyframe_time  = mesh_->skeleton.keyframes[state->current_keyframe].time;
-			if (k.time >= current_keyframe_time && k.time < current_keyframe_time + 0.5) {
-				mesh_->skeleton.keyframes[state->current_keyframe] = k;
-			} else if (k.time >= mesh_->skeleton.keyframes[state->prev_keyframe].time && k.time < mesh_->skeleton.keyframes[state->prev_keyframe].time + 0.5) {
-				//backwards replace
-				mesh_->skeleton.keyframes[state->prev_keyframe] = k;
-			} else if(k.time < current_keyframe_time){
-				mesh_->skeleton.keyframes.insert(mesh_->skeleton.keyframes.begin() + state->current_keyframe, k);
-			} else if (k.time > current_keyframe_time){
-				mesh_->skeleton.keyframes.insert(mesh_->skeleton.keyframes.begin() + state->current_keyframe + 1, k);
-				state->prev_keyframe = state->current_keyframe;
-				state->current_keyframe = state->current_keyframe + 1;
-				state->next_keyframe = glm::clamp(state->current_keyframe + 1,0,getNumKeyframes()-1);
-			}
+			// keep keyframes sorted by time
+			keyframes.insert(keyframes.begin() + cur + 1, k);
 		}
-		
-		state->old_time = pause_time;
-
-		state->end_keyframe = mesh_->skeleton.keyframes.size()-1;
+		mesh_->rebuildTrack();
+		state->current_keyframe = mesh_->skeleton.findKeyframe(k.time);
 		save_texture_ = true;
 
 	}else if (key == GLFW_KEY_L && action == GLFW_RELEASE) {
@@ -361,6 +362,7 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 
 		sceneState->end_light_keyframe = lightKeyframes.size() - 1;
 		sceneState->old_time = pause_time;
+		scene_keyframe_version_++;
 	
 	}else if (key == GLFW_KEY_V && action == GLFW_RELEASE) {
 		CameraKeyFrame ck;
@@ -391,6 +393,7 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 
 		sceneState->old_time2 = pause_time;
 		sceneState->end_camera_keyframe = cameraKeyframes.size() - 1;
+		scene_keyframe_version_++;
 	
 	}else if (key == GLFW_KEY_P && action == GLFW_RELEASE) {
 		//either play/pause animation
@@ -401,16 +404,12 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 		}
 		play_start = chrono::steady_clock::now();
 
-		state->old_time = pause_time;
 		sceneState->old_time = pause_time;
 		sceneState->old_time2 = pause_time;
 
 	} else if (key == GLFW_KEY_R && action == GLFW_RELEASE) {
 		//rewind animation
 		state->current_time = 0;
-		state->current_keyframe = 0;
-		state->next_keyframe = 1;
-		state->old_time = 0;
 
 		sceneState->current_time = 0;
 		
@@ -439,7 +438,7 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 	// 	if(selected_frame != -1 && selected_frame < getNumKeyframes()) {
 	// 		KeyFrame k;
 	// 		for(int bone = 0; bone < mesh_->getNumberOfBones(); ++bone) {
-	// 			k.rel_rot.push_back(glm::quat_cast(mesh_->skeleton.joints[bone].t));
+	// 			k.rel_rot.push_back(glm::quat_cast(mesh_->skeleton.localTransform(bone)));
 	// 		}
 	// 		//k.light_pos = light_position_;
 	// 		//k.camera_pos = eye_;
@@ -500,8 +499,8 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 }
 
 glm::mat4 GUI::boneTransform(){
-	Joint j = mesh_->skeleton.joints[current_bone_];
-	glm::vec3 parentpos =  mesh_->skeleton.joints[j.parent_index].position;
+	const Joint& j = mesh_->skeleton.joints[current_bone_];
+	glm::vec3 parentpos =  mesh_->skeleton.jointPosition(j.parent_index);
 	glm::vec3 tangent = glm::normalize( j.init_rel_position);
 		glm::vec3 n;
 		if(tangent[0] <= tangent[1] && tangent[0] <= tangent[2]){
@@ -514,10 +513,10 @@ glm::mat4 GUI::boneTransform(){
 		glm::vec3 normal = glm::normalize(glm::cross(tangent, n));
 		glm::vec3 bitan = glm::normalize(glm::cross(tangent,normal));
 		double height = glm::distance(glm::vec3(0),j.init_rel_position);
-		glm::vec3 pos = (parentpos + j.position) * glm::vec3(.5, .5, .5);
+		glm::vec3 pos = (parentpos + mesh_->skeleton.jointPosition(current_bone_)) * glm::vec3(.5, .5, .5);
 		glm::mat4 scale = glm::mat4(kCylinderRadius, 0, 0, 0, 0, height, 0, 0, 0, 0, kCylinderRadius, 0, 0, 0, 0, 1);
 		glm::mat4 toworld = (glm::mat4(glm::vec4(normal,0),glm::vec4(tangent,0),glm::vec4(bitan,0),glm::vec4(0,0,0,1)));
-		return mesh_->skeleton.joints[j.parent_index].d * toworld *  scale;
+		return mesh_->skeleton.worldTransform(j.parent_index) * toworld *  scale;
 }
 
 glm::mat4 GUI::lightTransform(){
@@ -732,6 +731,24 @@ void GUI::updateScene(float t){
 }
 
 void GUI::mousePosCallback(double mouse_x, double mouse_y)
+{
+	// High polling rate mice report many positions per frame, keep the
+	// latest one and let processInput pick and drag once.
+	pending_x_ = mouse_x;
+	pending_y_ = mouse_y;
+	pending_moves_++;
+}
+
+void GUI::processInput()
+{
+	if (pending_moves_ == 0)
+		return;
+	int moves = pending_moves_;
+	pending_moves_ = 0;
+	handleMouseMotion(pending_x_, pending_y_, moves);
+}
+
+void GUI::handleMouseMotion(double mouse_x, double mouse_y, int moves)
 {
 	last_x_ = current_x_;
 	last_y_ = current_y_;
@@ -750,7 +767,7 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 	glm::uvec4 viewport = glm::uvec4(0, 0, view_width_, view_height_);
 
 	bool drag_camera = drag_state_ && current_button_ == GLFW_MOUSE_BUTTON_RIGHT;
-	bool drag_bone = drag_state_ && current_button_ == GLFW_MOUSE_BUTTON_LEFT && transparent_;
+	bool drag_bone = drag_state_ && current_button_ == GLFW_MOUSE_BUTTON_LEFT && (transparent_ || surface_grab_);
 	bool drag_light = drag_state_ && current_button_ == GLFW_MOUSE_BUTTON_MIDDLE && chosen_axis != none;
 	bool drag_scrub = drag_state_ && current_button_ == GLFW_MOUSE_BUTTON_LEFT;
 
@@ -789,7 +806,8 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 				orientation_ *
 				glm::vec3(mouse_direction.y, -mouse_direction.x, 0.0f)
 				);
-		glm::mat4 rot =	glm::rotate(rotation_speed_, axis);	
+		// one step per reported motion, as when every event was handled
+		glm::mat4 rot =	glm::rotate(rotation_speed_ * moves, axis);
 		orientation_ =
 			glm::mat3(rot * glm::mat4(orientation_));
 		tangent_ = glm::column(orientation_, 0);
@@ -797,7 +815,7 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 		look_ = glm::column(orientation_, 2);
 	} else if (drag_bone && current_bone_ != -1) {
 		// FIXME: Handle bone rotation
-		glm::vec4 parentpos =  glm::vec4(mesh_->skeleton.joints[mesh_->skeleton.joints[current_bone_].parent_index].position, 1);
+		glm::vec4 parentpos =  glm::vec4(mesh_->skeleton.jointPosition(mesh_->skeleton.joints[current_bone_].parent_index), 1);
 		parentpos = projection_matrix_ * view_matrix_ * parentpos;
 		parentpos = parentpos / glm::vec4(parentpos.w,parentpos.w,parentpos.w,parentpos.w);
 		glm::vec2 ndc_coords = glm::vec2((parentpos.x+1)*view_width_/2, (parentpos.y+1)*(view_height_ )/2);
@@ -805,7 +823,7 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 		glm::vec2 a = mouse_start - ndc_coords;
 		glm::vec2 b = mouse_end - ndc_coords;
 		
-		glm::mat4 parentcoords = mesh_->skeleton.joints[mesh_->skeleton.joints[current_bone_].parent_index].d;
+		glm::mat4 parentcoords = mesh_->skeleton.worldTransform(mesh_->skeleton.joints[current_bone_].parent_index);
 		double det = a.x*b.y - a.y*b.x;
 		// float angle = atan2(det, glm::dot(a,b)) * 180 / 3.14;
 		float angle = atan2(det, glm::dot(a,b));
@@ -813,7 +831,7 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 		//change look to local coordinates
 
 		glm::mat4 r = glm::rotate(-angle, glm::vec3(glm::inverse(parentcoords)*glm::vec4(look_,0)));
-		mesh_->skeleton.rotate(mesh_->skeleton.joints[current_bone_].parent_index,current_bone_, r);
+		mesh_->skeleton.rotate(mesh_->skeleton.joints[current_bone_].parent_index, r);
 		pose_changed_ = true;
 		
 		return;
@@ -858,16 +876,10 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 	}
 
 	// FIXME: highlight bones that have been moused over
-	double ndc_x = mouse_x * 2/ view_width_ -1;
-	double ndc_y = (window_height_ - mouse_y) * 2 / view_height_ -1;
-	glm::vec4 ndc_coords = glm::vec4(ndc_x,ndc_y, 1, 1);
+	glm::vec4 dir = glm::vec4(cursorDirection(), 0);
 
-	glm::vec4 world_coords = glm::inverse(view_matrix_)*glm::inverse(projection_matrix_) * ndc_coords;
-	world_coords = world_coords/world_coords[3];
-
-	glm::vec4 dir = world_coords - glm::vec4(eye_,1);
-
-	if(!drag_state_){
+	// with GPU picking the ID buffer finds the axes, see setHoveredLightAxis
+	if(!drag_state_ && !gpu_picking_){
 		glm::mat4 light_coords = glm::mat4(1.0);
 		light_coords[3]= light_position_;
 		light_coords = glm::inverse(light_coords);
@@ -908,50 +920,66 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 	}
 
 
-	int min_bone = -1;
-	double min_time = 0;
-	for(int bone = 1; bone < mesh_->getNumberOfBones(); ++bone){
-		Joint j = mesh_->skeleton.joints[bone];
-		glm::vec3 parentpos =  mesh_->skeleton.joints[j.parent_index].position;
+	// the ID buffer picks instead, see setHoveredBone
+	if (gpu_picking_)
+		return;
+	// the tree follows the joints through refits, its layout is kept
+	if (bvh_pose_version_ != mesh_->skeleton.getPoseVersion()) {
+		bone_bvh_.refit(mesh_->skeleton);
+		bvh_pose_version_ = mesh_->skeleton.getPoseVersion();
+	}
+	current_bone_ = bone_bvh_.intersect(BoneRay{eye_, glm::vec3(dir)}).bone;
+}
 
-		glm::vec3 tangent = glm::normalize(parentpos - j.position );
-		glm::vec3 n;
-		glm::vec3 abstan = glm::abs(tangent);
-		if(abstan[0] <= abstan[1] && abstan[0] <= abstan[2]){
-				n = glm::vec3(1,0,0);
-		} else if (abstan[1] <= abstan[0] && abstan[1] <= abstan[2]) {
-				n = glm::vec3(0,1,0);
-		} else {
-				n = glm::vec3(0,0,1);
-		}
+glm::vec3 GUI::cursorDirection() const
+{
+	double ndc_x = current_x_ * 2 / view_width_ - 1;
+	double ndc_y = current_y_ * 2 / view_height_ - 1;
+	glm::vec4 ndc_coords = glm::vec4(ndc_x, ndc_y, 1, 1);
 
-		glm::vec3 normal = glm::normalize(glm::cross(tangent, n));
-		glm::vec3 bitan = glm::normalize(glm::cross(tangent,normal));
-		glm::mat4 tolocal = glm::inverse(glm::mat4(glm::vec4(bitan,0),glm::vec4(normal,0),glm::vec4(tangent,0),glm::vec4(j.position,1)));
-		double time;
-		glm::mat4 inverse = glm::inverse(j.d);
-		double cyl_len = glm::distance(j.position,parentpos);
+	glm::vec4 world_coords = glm::inverse(view_matrix_) * glm::inverse(projection_matrix_) * ndc_coords;
+	world_coords = world_coords / world_coords[3];
+	return glm::vec3(world_coords) - eye_;
+}
 
-		if (intersectLocal(glm::dvec3(tolocal*glm::vec4(eye_,1)), glm::dvec3(tolocal*dir),time,cyl_len)){
-			
-			if (min_bone == -1 || time < min_time ) {
-				min_time = time;
-				min_bone = bone;
-			}
-		}
+bool GUI::pickSurface()
+{
+	// the palette only exists once the first frame posed the mesh
+	if (mesh_->load_d_u().size() < size_t(mesh_->getNumberOfBones()))
+		return false;
+	unsigned version = mesh_->skeleton.getPoseVersion();
+	if (mesh_bvh_.empty() || mesh_bvh_pose_version_ != version) {
+		surface_skinner_.skin(*mesh_);
+		if (mesh_bvh_.empty())
+			mesh_bvh_.build(*mesh_, surface_skinner_.getPositions());
+		else
+			mesh_bvh_.refit(surface_skinner_.getPositions());
+		mesh_bvh_pose_version_ = version;
 	}
-
-	current_bone_ = min_bone;
+	surface_hit_ = mesh_bvh_.intersect(BoneRay{eye_, cursorDirection()});
+	int slot = dominantSlot(*mesh_, surface_hit_.face, surface_hit_.barycentric);
+	if (slot < 0)
+		return false;
+	current_bone_ = mesh_->skeleton.jointAt(slot);
+	return true;
 }
 
 void GUI::mouseButtonCallback(int button, int action, int mods)
 {	
+	// the press applies where the cursor is now
+	processInput();
 	if(action == GLFW_RELEASE){	
 		move_scrub = false;
 	}
 	if (current_x_ <= view_width_) {
 		drag_state_ = (action == GLFW_PRESS);
 		current_button_ = button;
+		// A click on the model grabs the bone that moves it most, the
+		// bones themselves come first when they are shown.
+		surface_grab_ = false;
+		if (drag_state_ && button == GLFW_MOUSE_BUTTON_LEFT && current_y_ < view_height_
+		    && (!transparent_ || current_bone_ == -1) && chosen_axis == none)
+			surface_grab_ = pickSurface();
 		return ;
 	}
 	// FIXME: Key Frame Selection
@@ -970,6 +998,7 @@ void GUI::mouseButtonCallback(int button, int action, int mods)
 
 void GUI::mouseScrollCallback(double dx, double dy)
 {
+	processInput();
 	if (current_x_ < view_width_)
 		return;
 	// FIXME: Mouse Scrolling
@@ -1006,6 +1035,23 @@ MatrixPointers GUI::getMatrixPointers() const
 	return ret;
 }
 
+void GUI::setHoveredBone(int joint)
+{
+	// keep the bone that is being dragged
+	if (drag_state_ && current_button_ == GLFW_MOUSE_BUTTON_LEFT)
+		return;
+	current_bone_ = joint;
+}
+
+void GUI::setHoveredLightAxis(int axis)
+{
+	// keep the axis that is being dragged
+	if (drag_state_)
+		return;
+	chosen_axis = axis;
+	on_light_ = axis != none;
+}
+
 bool GUI::setCurrentBone(int i)
 {
 	if (i < 0 || i >= mesh_->getNumberOfBones())
@@ -5,6 +5,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <GLFW/glfw3.h>
 #include "bone_geometry.h"
+#include "bone_bvh.h"
+#include "mesh_bvh.h"
+#include "cpu_skinner.h"
+#include "skin_cache.h"
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/spline.hpp>
@@ -33,6 +37,8 @@ public:
 	void mousePosCallback(double mouse_x, double mouse_y);
 	void mouseButtonCallback(int button, int action, int mods);
 	void mouseScrollCallback(double dx, double dy);
+	// Handles the cursor motion queued since the last call, once per frame.
+	void processInput();
 	void updateMatrices();
 	MatrixPointers getMatrixPointers() const;
 
@@ -53,11 +59,25 @@ public:
 	int getCurrentBone() const { return current_bone_; }
 	const int* getCurrentBonePointer() const { return &current_bone_; }
 	bool setCurrentBone(int i);
+	// Picking result of the ID buffer, -1 for none.
+	void setHoveredBone(int joint);
+	// Light axis under the cursor in the ID buffer, none for none.
+	void setHoveredLightAxis(int axis);
+	bool useGpuPicking() const { return gpu_picking_; }
+	// Cursor in view pixels, origin at the bottom left.
+	glm::vec2 getMousePosition() const { return glm::vec2(current_x_, current_y_); }
+	// Last left click on the skinned surface, face -1 if it missed.
+	const MeshHit& getSurfaceHit() const { return surface_hit_; }
 
 	bool saveScreenshot() const { return save_screen_; }
 	void resetScreenshot() { save_screen_ = false; }
+	bool validateSkinning() const { return validate_skinning_; }
+	void resetSkinningValidation() { validate_skinning_ = false; }
 
 	bool isTransparent() const { return transparent_; }
+	bool isDualQuaternion() const { return dual_quaternion_; }
+	bool useGeometryShader() const { return geometry_shader_; }
+	SkinningBackend getSkinningBackend() const { return skinning_backend_; }
 	bool isPlaying() const { return play_; }
 	bool isScrubbing() const {return scrubbing_;}
 	float getCurrentPlayTime() const;
@@ -119,16 +139,21 @@ public:
 	float getPauseTime() { return pause_time; }
 
 	void getLightKeyframeTimes(vector<float>& result) {
-		for (LightKeyFrame l: lightKeyframes) {
+		for (const LightKeyFrame& l: lightKeyframes) {
 			result.push_back(l.time);
 		}
 	}
 
 	void getCameraKeyframeTimes(vector<float>& result) {
-		for (CameraKeyFrame c: cameraKeyframes) {
+		for (const CameraKeyFrame& c: cameraKeyframes) {
 			result.push_back(c.time);
 		}
 	}
+	// Changes whenever a model, light or camera keyframe is edited or
+	// loaded, like Skeleton::getPoseVersion for poses.
+	unsigned getKeyframeVersion() const {
+		return scene_keyframe_version_ + mesh_->skeleton.getKeyframeVersion();
+	}
 
 	void saveAnimationTo(const std::string& fn);
 	void loadAnimationFrom(const std::string& fn);
@@ -181,6 +206,10 @@ private:
 	bool fps_mode_ = false;
 	bool pose_changed_ = true;
 	bool transparent_ = false;
+	bool dual_quaternion_ = false;
+	bool geometry_shader_ = true;
+	bool gpu_picking_ = false;
+	SkinningBackend skinning_backend_ = kVertexShaderSkinning;
 	bool on_light_ = false;
 	int current_bone_ = -1;
 	int current_button_ = -1;
@@ -193,6 +222,7 @@ private:
 	float aspect_;
 
 	bool save_screen_ = false;
+	bool validate_skinning_ = false;
 
 	glm::vec3 eye_ = glm::vec3(0.0f, 0.1f, camera_distance_);
 	glm::vec3 up_ = glm::vec3(0.0f, 1.0f, 0.0f);
@@ -211,6 +241,23 @@ private:
 	int chosen_axis = none;
 
 	bool captureWASDUPDOWN(int key, int action);
+	void handleMouseMotion(double mouse_x, double mouse_y, int moves);
+	glm::vec3 cursorDirection() const;
+	bool pickSurface();
+
+	double pending_x_ = 0.0, pending_y_ = 0.0;
+	int pending_moves_ = 0;
+
+	// Bone picking, refit when the skeleton's pose version moves on.
+	BoneBvh bone_bvh_;
+	unsigned bvh_pose_version_ = 0;
+	// Surface picking, skinned and refit lazily on the first click after
+	// the pose changed.
+	CpuSkinner surface_skinner_;
+	MeshBvh mesh_bvh_;
+	unsigned mesh_bvh_pose_version_ = 0;
+	MeshHit surface_hit_;
+	bool surface_grab_ = false;
 
 	bool play_ = false;
 	bool scrubbing_ = false;
@@ -229,6 +276,8 @@ private:
 	double intensity_ = 1.0;
 	vector<LightKeyFrame> lightKeyframes;
 	vector<CameraKeyFrame> cameraKeyframes;
+	// bumped on every edit of lightKeyframes or cameraKeyframes
+	unsigned scene_keyframe_version_ = 0;
 	bool move_scrub = false;
 };
 
@@ -0,0 +1,88 @@
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <iostream>
+#include "id_picker.h"
+
+IdPicker::IdPicker()
+{
+}
+
+IdPicker::~IdPicker()
+{
+	for (int i = 0; i < kReads; i++)
+		if (fence_[i])
+			glDeleteSync(GLsync(fence_[i]));
+	if (pbo_[0])
+		glDeleteBuffers(kReads, pbo_);
+}
+
+void IdPicker::resize(int width, int height)
+{
+	target_.create(width, height, TextureToRender::kObjectId);
+	if (pbo_[0])
+		return;
+	CHECK_GL_ERROR(glGenBuffers(kReads, pbo_));
+	for (int i = 0; i < kReads; i++) {
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_[i]));
+		CHECK_GL_ERROR(glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_READ));
+	}
+	CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+}
+
+void IdPicker::begin()
+{
+	target_.bind();
+	const GLuint none[4] = { 0, 0, 0, 0 };
+	CHECK_GL_ERROR(glClearBufferuiv(GL_COLOR, 0, none));
+	CHECK_GL_ERROR(glClear(GL_DEPTH_BUFFER_BIT));
+}
+
+void IdPicker::end(int x, int y)
+{
+	// a read that was never collected is dropped
+	if (issued_ - collected_ == kReads)
+		collected_++;
+	int i = issued_ % kReads;
+	if (x >= 0 && y >= 0 && x < target_.getWidth() && y < target_.getHeight()) {
+		CHECK_GL_ERROR(glReadBuffer(GL_COLOR_ATTACHMENT0));
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_[i]));
+		CHECK_GL_ERROR(glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr));
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+	} else {
+		// outside of the view, reads back as nothing
+		const GLuint none = 0;
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_[i]));
+		CHECK_GL_ERROR(glBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(none), &none));
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+	}
+	if (fence_[i])
+		glDeleteSync(GLsync(fence_[i]));
+	fence_[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	issued_++;
+	target_.unbind();
+}
+
+bool IdPicker::poll(Result& result)
+{
+	bool found = false;
+	GLuint id = 0;
+	while (collected_ < issued_) {
+		int i = collected_ % kReads;
+		GLenum status = glClientWaitSync(GLsync(fence_[i]), 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		// the copy has landed, reading the buffer does not stall
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_[i]));
+		CHECK_GL_ERROR(glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(id), &id));
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+		glDeleteSync(GLsync(fence_[i]));
+		fence_[i] = nullptr;
+		collected_++;
+		found = true;
+	}
+	if (!found)
+		return false;
+	result.kind = Kind(id >> kIndexBits);
+	result.index = result.kind == kNone ? -1 : int(id & ((1u << kIndexBits) - 1));
+	return true;
+}
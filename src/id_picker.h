@@ -0,0 +1,52 @@
+#ifndef ID_PICKER_H
+#define ID_PICKER_H
+
+#include "texture_to_render.h"
+
+/*
+ * IdPicker: GPU picking with an ID buffer.
+ *
+ * Passes drawn between begin() and end() write an object ID per pixel
+ * (shaders/id.frag) into an integer TextureToRender. end() copies only the
+ * pixel under the cursor into a pixel buffer object and poll() reads it a
+ * frame or two later, once its fence has passed, so picking never waits
+ * for the GPU.
+ *
+ * An ID is baseId(kind) plus gl_PrimitiveID: the triangle for the mesh,
+ * the bone's child slot for bones (shaders/bone_id.geom), and for the
+ * light the GUI axis of a drag handle, or GUI::none and up for the sphere.
+ */
+class IdPicker {
+public:
+	enum Kind { kNone, kBone, kLight, kTriangle };
+	struct Result {
+		Kind kind = kNone;
+		int index = -1;
+	};
+	// object_id of the passes drawing kind.
+	static int baseId(Kind kind) { return int(kind) << kIndexBits; }
+
+	IdPicker();
+	~IdPicker();
+	IdPicker(const IdPicker&) = delete;
+	IdPicker& operator=(const IdPicker&) = delete;
+
+	void resize(int width, int height);
+	// Clears the ID buffer and renders into it.
+	void begin();
+	// Back to the default framebuffer, queues the read of pixel (x, y).
+	void end(int x, int y);
+	// Latest finished read, false if none finished since the last call.
+	bool poll(Result& result);
+private:
+	static const int kIndexBits = 28;
+	static const int kReads = 3;
+
+	TextureToRender target_;
+	unsigned pbo_[kReads] = {};
+	void* fence_[kReads] = {}; // GLsync
+	int issued_ = 0;
+	int collected_ = 0;
+};
+
+#endif
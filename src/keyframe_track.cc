@@ -0,0 +1,310 @@
+#include "keyframe_track.h"
+#include "bone_geometry.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+// KEYFRAME_TRACK_SCALAR forces the portable kernels, bench/ uses it to
+// compare them with the SIMD ones.
+#if !defined(KEYFRAME_TRACK_SCALAR) && defined(__AVX2__)
+#define KEYFRAME_TRACK_AVX2
+#include <immintrin.h>
+#elif !defined(KEYFRAME_TRACK_SCALAR) && (defined(__SSE2__) || defined(_M_X64))
+#define KEYFRAME_TRACK_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+/*
+ * One register worth of lanes and the handful of operations the kernels
+ * need. Everything below this block is written once against these.
+ */
+#if defined(KEYFRAME_TRACK_AVX2)
+typedef __m256 Pack;
+typedef __m256 Mask;
+const int kPackWidth = 8;
+inline Pack load(const float* p) { return _mm256_load_ps(p); }
+inline void store(float* p, Pack v) { _mm256_store_ps(p, v); }
+inline Pack splat(float f) { return _mm256_set1_ps(f); }
+inline Pack add(Pack a, Pack b) { return _mm256_add_ps(a, b); }
+inline Pack sub(Pack a, Pack b) { return _mm256_sub_ps(a, b); }
+inline Pack mul(Pack a, Pack b) { return _mm256_mul_ps(a, b); }
+inline Pack div(Pack a, Pack b) { return _mm256_div_ps(a, b); }
+inline Pack sqrt(Pack a) { return _mm256_sqrt_ps(a); }
+inline Pack min(Pack a, Pack b) { return _mm256_min_ps(a, b); }
+inline Pack max(Pack a, Pack b) { return _mm256_max_ps(a, b); }
+inline Mask less(Pack a, Pack b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline Mask greater(Pack a, Pack b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline Pack select(Mask m, Pack a, Pack b) { return _mm256_blendv_ps(b, a, m); }
+#elif defined(KEYFRAME_TRACK_SSE)
+typedef __m128 Pack;
+typedef __m128 Mask;
+const int kPackWidth = 4;
+inline Pack load(const float* p) { return _mm_load_ps(p); }
+inline void store(float* p, Pack v) { _mm_store_ps(p, v); }
+inline Pack splat(float f) { return _mm_set1_ps(f); }
+inline Pack add(Pack a, Pack b) { return _mm_add_ps(a, b); }
+inline Pack sub(Pack a, Pack b) { return _mm_sub_ps(a, b); }
+inline Pack mul(Pack a, Pack b) { return _mm_mul_ps(a, b); }
+inline Pack div(Pack a, Pack b) { return _mm_div_ps(a, b); }
+inline Pack sqrt(Pack a) { return _mm_sqrt_ps(a); }
+inline Pack min(Pack a, Pack b) { return _mm_min_ps(a, b); }
+inline Pack max(Pack a, Pack b) { return _mm_max_ps(a, b); }
+inline Mask less(Pack a, Pack b) { return _mm_cmplt_ps(a, b); }
+inline Mask greater(Pack a, Pack b) { return _mm_cmpgt_ps(a, b); }
+// SSE2 has no blendv, select bitwise.
+inline Pack select(Mask m, Pack a, Pack b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+#else
+typedef float Pack;
+typedef bool Mask;
+const int kPackWidth = 1;
+inline Pack load(const float* p) { return *p; }
+inline void store(float* p, Pack v) { *p = v; }
+inline Pack splat(float f) { return f; }
+inline Pack add(Pack a, Pack b) { return a + b; }
+inline Pack sub(Pack a, Pack b) { return a - b; }
+inline Pack mul(Pack a, Pack b) { return a * b; }
+inline Pack div(Pack a, Pack b) { return a / b; }
+inline Pack sqrt(Pack a) { return std::sqrt(a); }
+inline Pack min(Pack a, Pack b) { return a < b ? a : b; }
+inline Pack max(Pack a, Pack b) { return a > b ? a : b; }
+inline Mask less(Pack a, Pack b) { return a < b; }
+inline Mask greater(Pack a, Pack b) { return a > b; }
+inline Pack select(Mask m, Pack a, Pack b) { return m ? a : b; }
+#endif
+
+static_assert(kTrackLanes % kPackWidth == 0, "track padding must cover a whole register");
+
+const float kPi = 3.14159265358979f;
+
+// acos on [-1, 1], Abramowitz & Stegun 4.4.46 (|error| < 2e-8 on [0, 1]),
+// mirrored with acos(-x) = pi - acos(x).
+inline Pack acos(Pack x)
+{
+	Mask negative = less(x, splat(0.0f));
+	Pack a = min(select(negative, sub(splat(0.0f), x), x), splat(1.0f));
+	Pack p = splat(-0.0012624911f);
+	p = add(mul(p, a), splat(0.0066700901f));
+	p = add(mul(p, a), splat(-0.0170881256f));
+	p = add(mul(p, a), splat(0.0308918810f));
+	p = add(mul(p, a), splat(-0.0501743046f));
+	p = add(mul(p, a), splat(0.0889789874f));
+	p = add(mul(p, a), splat(-0.2145988016f));
+	p = add(mul(p, a), splat(1.5707963050f));
+	Pack r = mul(sqrt(sub(splat(1.0f), a)), p);
+	return select(negative, sub(splat(kPi), r), r);
+}
+
+// sin on [0, pi], folded onto [0, pi/2] where the Taylor series up to x^11
+// is accurate to float precision.
+inline Pack sin(Pack x)
+{
+	Pack a = min(x, sub(splat(kPi), x));
+	Pack a2 = mul(a, a);
+	Pack p = splat(-1.0f / 39916800.0f);
+	p = add(mul(p, a2), splat(1.0f / 362880.0f));
+	p = add(mul(p, a2), splat(-1.0f / 5040.0f));
+	p = add(mul(p, a2), splat(1.0f / 120.0f));
+	p = add(mul(p, a2), splat(-1.0f / 6.0f));
+	p = add(mul(p, a2), splat(1.0f));
+	return mul(a, p);
+}
+
+struct QuatPack {
+	Pack x, y, z, w;
+};
+
+inline QuatPack loadQuat(const float* block, int stride, int i)
+{
+	return QuatPack{ load(block + i),
+	                 load(block + stride + i),
+	                 load(block + 2 * stride + i),
+	                 load(block + 3 * stride + i) };
+}
+
+inline void storeQuat(float* block, int stride, int i, const QuatPack& q)
+{
+	store(block + i, q.x);
+	store(block + stride + i, q.y);
+	store(block + 2 * stride + i, q.z);
+	store(block + 3 * stride + i, q.w);
+}
+
+// glm::slerp when shortest is true, glm::mix otherwise.
+inline QuatPack interpolate(const QuatPack& a, QuatPack b, float t, bool shortest)
+{
+	Pack c = add(add(mul(a.x, b.x), mul(a.y, b.y)),
+	             add(mul(a.z, b.z), mul(a.w, b.w)));
+	if (shortest) {
+		Pack sign = select(less(c, splat(0.0f)), splat(-1.0f), splat(1.0f));
+		b.x = mul(b.x, sign);
+		b.y = mul(b.y, sign);
+		b.z = mul(b.z, sign);
+		b.w = mul(b.w, sign);
+		c = mul(c, sign);
+	}
+	Pack vt = splat(t);
+	Pack vs = splat(1.0f - t);
+	Pack angle = acos(c);
+	Pack inv = div(splat(1.0f), sin(angle));
+	// Nearly parallel quaternions fall back to lerp like glm does, the
+	// discarded slerp weights may be inf/NaN in those lanes.
+	Mask parallel = greater(c, splat(1.0f - std::numeric_limits<float>::epsilon()));
+	Pack wa = select(parallel, vs, mul(sin(mul(vs, angle)), inv));
+	Pack wb = select(parallel, vt, mul(sin(mul(vt, angle)), inv));
+	return QuatPack{ add(mul(wa, a.x), mul(wb, b.x)),
+	                 add(mul(wa, a.y), mul(wb, b.y)),
+	                 add(mul(wa, a.z), mul(wb, b.z)),
+	                 add(mul(wa, a.w), mul(wb, b.w)) };
+}
+
+inline glm::fquat quatAt(const float* block, int stride, int i)
+{
+	return glm::fquat(block[3 * stride + i], block[i],
+	                  block[stride + i], block[2 * stride + i]);
+}
+
+inline void setQuat(float* block, int stride, int i, const glm::fquat& q)
+{
+	block[i] = q.x;
+	block[stride + i] = q.y;
+	block[2 * stride + i] = q.z;
+	block[3 * stride + i] = q.w;
+}
+
+inline float* alignLanes(const float* p)
+{
+	uintptr_t a = reinterpret_cast<uintptr_t>(p);
+	a = (a + kLaneAlignment - 1) & ~uintptr_t(kLaneAlignment - 1);
+	return reinterpret_cast<float*>(a);
+}
+
+}
+
+void LaneBuffer::resize(size_t n)
+{
+	// std::vector only guarantees alignof(float), over-allocate so data()
+	// can be rounded up.
+	storage_.resize(n + kLaneAlignment / sizeof(float) - 1);
+	size_ = n;
+}
+
+float* LaneBuffer::data()
+{
+	return alignLanes(storage_.data());
+}
+
+const float* LaneBuffer::data() const
+{
+	return alignLanes(storage_.data());
+}
+
+void slerpLanes(const float* from, const float* to, float t,
+                float* out, int stride)
+{
+	for (int i = 0; i < stride; i += kPackWidth) {
+		QuatPack a = loadQuat(from, stride, i);
+		QuatPack b = loadQuat(to, stride, i);
+		storeQuat(out, stride, i, interpolate(a, b, t, true));
+	}
+}
+
+void squadLanes(const float* q1, const float* q2,
+                const float* s1, const float* s2, float h,
+                float* out, int stride)
+{
+	float k = 2.0f * (1.0f - h) * h;
+	for (int i = 0; i < stride; i += kPackWidth) {
+		QuatPack a = interpolate(loadQuat(q1, stride, i), loadQuat(q2, stride, i), h, false);
+		QuatPack b = interpolate(loadQuat(s1, stride, i), loadQuat(s2, stride, i), h, false);
+		storeQuat(out, stride, i, interpolate(a, b, k, false));
+	}
+}
+
+void KeyframeTrack::build(const std::vector<KeyFrame>& keyframes)
+{
+	int n = int(keyframes.size());
+	nbones_ = n == 0 ? 0 : int(keyframes[0].rel_rot.size());
+	stride_ = (nbones_ + kTrackLanes - 1) / kTrackLanes * kTrackLanes;
+	times_.resize(n);
+	for (int k = 0; k < n; ++k)
+		times_[k] = keyframes[k].time;
+	lanes_.resize(size_t(n) * kRecordSize * stride_);
+
+	std::vector<glm::fquat> q(n);
+	std::vector<glm::fquat> tangent(n);
+	for (int i = 0; i < stride_; ++i) {
+		// Padding lanes hold the identity so the kernels stay finite.
+		for (int k = 0; k < n; ++k)
+			q[k] = i < nbones_ ? keyframes[k].rel_rot[i] : glm::fquat();
+		// squad does not take the shortest path by itself, so keep
+		// neighbouring keys in the same hemisphere.
+		for (int k = 1; k < n; ++k)
+			if (glm::dot(q[k - 1], q[k]) < 0.0f)
+				q[k] = -q[k];
+		for (int k = 0; k < n; ++k)
+			tangent[k] = glm::intermediate(q[std::max(k - 1, 0)], q[k],
+			                               q[std::min(k + 1, n - 1)]);
+		for (int k = 0; k < n; ++k) {
+			float* record = lanes_.data() + size_t(k) * kRecordSize * stride_;
+			int next = std::min(k + 1, n - 1);
+			// a bone that does not move between two keys stays put
+			bool hold = KeyFrame::quatEquals(q[k], q[next]);
+			setQuat(record, stride_, i, q[k]);
+			setQuat(record + 4 * stride_, stride_, i, hold ? q[k] : tangent[k]);
+			setQuat(record + 8 * stride_, stride_, i, hold ? q[next] : tangent[next]);
+		}
+	}
+}
+
+const float* KeyframeTrack::getBlock(int keyframe) const
+{
+	return lanes_.data() + size_t(keyframe) * kRecordSize * stride_;
+}
+
+size_t KeyframeTrack::getScratchSize(int nbones)
+{
+	// one quaternion block, padded like the keyframe blocks
+	int stride = (nbones + kTrackLanes - 1) / kTrackLanes * kTrackLanes;
+	return size_t(4) * stride;
+}
+
+int KeyframeTrack::findKeyframe(float t) const
+{
+	auto it = std::upper_bound(times_.begin(), times_.end(), t);
+	return int(it - times_.begin()) - 1;
+}
+
+void KeyframeTrack::unpack(const float* block, std::vector<glm::fquat>& rel_rot) const
+{
+	rel_rot.resize(nbones_);
+	for (int i = 0; i < nbones_; ++i)
+		rel_rot[i] = quatAt(block, stride_, i);
+}
+
+void KeyframeTrack::sample(float t, std::vector<glm::fquat>& rel_rot,
+                           LaneBuffer& scratch) const
+{
+	int last = getNumberOfKeyframes() - 1;
+	if (last < 0) {
+		rel_rot.clear();
+		return;
+	}
+	int cur = findKeyframe(t);
+	if (cur < 0 || cur == last) {
+		unpack(getBlock(std::max(cur, 0)), rel_rot);
+		return;
+	}
+	float length = times_[cur + 1] - times_[cur];
+	float tau = length > 0.0f ? (t - times_[cur]) / length : 0.0f;
+
+	assert(scratch.size() >= getScratchSize());
+	const float* from = getBlock(cur);
+	squadLanes(from, getBlock(cur + 1),
+	           from + 4 * stride_, from + 8 * stride_,
+	           tau, scratch.data(), stride_);
+	unpack(scratch.data(), rel_rot);
+}
@@ -0,0 +1,99 @@
+#ifndef KEYFRAME_TRACK_H
+#define KEYFRAME_TRACK_H
+
+#include <vector>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+struct KeyFrame;
+
+/*
+ * Every SoA block is padded to a multiple of kTrackLanes bones and aligned
+ * to kLaneAlignment bytes, so the SSE (4 wide) and AVX2 (8 wide) kernels
+ * below never need a scalar tail loop.
+ */
+const int kTrackLanes = 8;
+const size_t kLaneAlignment = 32;
+
+/*
+ * LaneBuffer: a float array whose data() is aligned to kLaneAlignment.
+ * The content is not preserved across resize().
+ */
+class LaneBuffer {
+public:
+	void resize(size_t n);
+	size_t size() const { return size_; }
+	float* data();
+	const float* data() const;
+private:
+	std::vector<float> storage_;
+	size_t size_ = 0;
+};
+
+/*
+ * Batched quaternion kernels over SoA lanes.
+ *
+ * A quaternion block of `stride` bones stores all x components first,
+ * followed by all y, z and w components:
+ *      block[0, stride)            x
+ *      block[stride, 2 stride)     y
+ *      block[2 stride, 3 stride)   z
+ *      block[3 stride, 4 stride)   w
+ * stride must be a multiple of kTrackLanes and the blocks must be aligned
+ * to kLaneAlignment.
+ *
+ * slerpLanes matches glm::slerp (shortest path), squadLanes matches
+ * glm::squad. The AVX2 or SSE version is picked at compile time, with a
+ * portable scalar fallback.
+ */
+void slerpLanes(const float* from, const float* to, float t,
+                float* out, int stride);
+void squadLanes(const float* q1, const float* q2,
+                const float* s1, const float* s2, float h,
+                float* out, int stride);
+
+/*
+ * KeyframeTrack: contiguous structure-of-arrays copy of Skeleton::keyframes.
+ *
+ * Skeleton::keyframes stays the representation that the GUI edits and the
+ * JSON files store, the track is rebuilt from it whenever it changes (see
+ * Skeleton::rebuildTrack) and is what per-frame pose evaluation reads.
+ *
+ * Each keyframe k stores three blocks: its rotations, and the two squad
+ * control points of the segment from k to k + 1. The control points only
+ * depend on neighbouring keys, so they are computed in build() and
+ * sampling is a single squadLanes call.
+ */
+class KeyframeTrack {
+public:
+	void build(const std::vector<KeyFrame>& keyframes);
+
+	int getNumberOfKeyframes() const { return int(times_.size()); }
+	int getNumberOfBones() const { return nbones_; }
+	int getStride() const { return stride_; }
+	float getTime(int keyframe) const { return times_[keyframe]; }
+	const float* getBlock(int keyframe) const;
+	// Floats sample() needs in its scratch buffer for a rig of nbones.
+	static size_t getScratchSize(int nbones);
+	size_t getScratchSize() const { return getScratchSize(nbones_); }
+
+	// Index of the last keyframe at or before t, -1 if t precedes all of them.
+	int findKeyframe(float t) const;
+	// Interpolated rotations at time t. scratch is owned by the caller so
+	// that concurrent samplers do not share state, and must hold
+	// getScratchSize() floats so that sampling never allocates.
+	void sample(float t, std::vector<glm::fquat>& rel_rot,
+	            LaneBuffer& scratch) const;
+private:
+	void unpack(const float* block, std::vector<glm::fquat>& rel_rot) const;
+
+	static const int kRecordSize = 3 * 4; // floats per bone per keyframe
+
+	int nbones_ = 0;
+	int stride_ = 0;
+	std::vector<float> times_;
+	LaneBuffer lanes_;
+};
+
+#endif
@@ -5,14 +5,27 @@
 #include "render_pass.h"
 #include "config.h"
 #include "gui.h"
+#include "alloc_counter.h"
+#include "palette_buffer.h"
+#include "vertex_format.h"
+#include "gpu_timer.h"
+#include "skin_cache.h"
+#include "compute_skinner.h"
+#include "cpu_skinner.h"
+#include "id_picker.h"
+#include "frame_constants.h"
+#include "gl_state.h"
 #include <jpegio.h>
 
+#include <cstddef>
 #include <algorithm>
+#include <cassert>
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <sstream>
+#include <iomanip>
 
 #include <glm/gtx/component_wise.hpp>
 #include <glm/gtx/rotate_vector.hpp>
@@ -51,10 +64,64 @@ const char* vertex_shader =
 #include "shaders/default.vert"
 ;
 
-const char* blending_shader =
+// The skinned vertex shaders are put together from shared pieces, see
+// shaders/skinning.glsl. Which skin() they use depends on the model, so
+// the ones reading the bind pose are assembled in main().
+const char* skinning_header =
+#include "shaders/skinning.glsl"
+;
+
+const char* skin_lbs_source =
+#include "shaders/skin_lbs.glsl"
+;
+
+const char* skin_dq_source =
+#include "shaders/skin_dq.glsl"
+;
+
+// Up to four influences per vertex, for BDEF4 models.
+const char* skin_lbs4_source =
+#include "shaders/skin_lbs4.glsl"
+;
+
+const char* skin_dq4_source =
+#include "shaders/skin_dq4.glsl"
+;
+
+const char* blending_main =
 #include "shaders/blending.vert"
 ;
 
+// Same, without a geometry shader after them.
+const char* skinned_main =
+#include "shaders/skinned.vert"
+;
+
+// Skinning once into a SkinCache, and drawing from it.
+const char* skin_feedback_main =
+#include "shaders/skin_feedback.vert"
+;
+
+const char* cached_shader =
+#include "shaders/skinning.glsl"
+#include "shaders/skin_cached.glsl"
+#include "shaders/blending.vert"
+;
+
+const char* cached_flat_shader =
+#include "shaders/skinning.glsl"
+#include "shaders/skin_cached.glsl"
+#include "shaders/skinned.vert"
+;
+
+const char* skin_compute_shader =
+#include "shaders/skin.comp"
+;
+
+const char* flat_vertex_shader =
+#include "shaders/flat.vert"
+;
+
 const char* geometry_shader =
 #include "shaders/default.geom"
 ;
@@ -137,6 +204,23 @@ const char* box_fragment_shader =
 #include "shaders/box.frag"
 ;
 
+// ID buffer picking, see IdPicker.
+const char* id_fragment_shader =
+#include "shaders/id.frag"
+;
+
+const char* bone_id_vertex_shader =
+#include "shaders/bone_id.vert"
+;
+
+const char* bone_id_geometry_shader =
+#include "shaders/bone_id.geom"
+;
+
+const char* light_axes_id_vertex_shader =
+#include "shaders/light_axes_id.vert"
+;
+
 void ErrorCallback(int error, const char* description) {
 	std::cerr << "GLFW Error: " << description << "\n";
 }
@@ -210,13 +294,99 @@ bool LoadObj2(const char* filename, vector<glm::vec4>& vertices, vector<glm::uve
 }
 
 
+/*
+ * Headless batch export: skins every frame of the model animation on the
+ * CPU and writes <prefix>0000.obj, <prefix>0001.obj, ... No window or GL
+ * context is created.
+ */
+int exportAnimation(const std::string& pmd, const std::string& animation,
+                    const std::string& prefix, float fps)
+{
+	Mesh mesh;
+	mesh.loadPmd(pmd);
+	loadModelKeyframes(animation, mesh);
+	if (mesh.skeleton.keyframes.empty()) {
+		std::cerr << animation << " has no model keyframes" << std::endl;
+		return -1;
+	}
+	float duration = mesh.skeleton.keyframes.back().time;
+	int nframes = int(std::floor(duration * fps)) + 1;
+
+	AnimationState state;
+	CpuSkinner skinner;
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (int frame = 0; frame < nframes; ++frame) {
+		mesh.updateAnimation(frame / fps, &state);
+		skinner.skin(mesh);
+		lo = glm::min(lo, skinner.getBounds().min);
+		hi = glm::max(hi, skinner.getBounds().max);
+
+		std::stringstream fn;
+		fn << prefix << std::setfill('0') << std::setw(4) << frame << ".obj";
+		if (!skinner.saveObj(mesh, fn.str())) {
+			std::cerr << "Cannot write " << fn.str() << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "Exported " << nframes << " frames, skinned bounds min = "
+	          << lo << " max = " << hi << std::endl;
+	return 0;
+}
+
+/*
+ * Skinning validation: reads the skin cache back and prints its largest
+ * distance from CpuSkinner for the palette the GPU just used.
+ */
+void validateSkinCache(const Mesh& mesh, const SkinCache& cache, SkinningBackend backend)
+{
+	const char* name = backend == kComputeSkinning ? "compute" : "transform feedback";
+	if (mesh.getSkinningMode() != kLinearBlendSkinning) {
+		std::cout << "Cannot validate " << name
+		          << " skinning: CpuSkinner only does linear blend skinning" << std::endl;
+		return;
+	}
+	CpuSkinner skinner;
+	skinner.skin(mesh);
+	std::vector<glm::vec3> gpu_positions;
+	cache.readPositions(gpu_positions);
+	const std::vector<glm::vec4>& cpu_positions = skinner.getPositions();
+	if (gpu_positions.size() != cpu_positions.size()) {
+		std::cout << "Cannot validate " << name << " skinning: the cache has "
+		          << gpu_positions.size() << " vertices, the mesh "
+		          << cpu_positions.size() << std::endl;
+		return;
+	}
+	float max_error = 0.0f;
+	size_t worst = 0;
+	for (size_t i = 0; i < gpu_positions.size(); i++) {
+		float error = glm::distance(gpu_positions[i], glm::vec3(cpu_positions[i]));
+		if (error > max_error) {
+			max_error = error;
+			worst = i;
+		}
+	}
+	std::cout << "Validated " << name << " skinning: max distance from CpuSkinner "
+	          << max_error << " at vertex " << worst << " of "
+	          << gpu_positions.size() << std::endl;
+}
+
 int main(int argc, char* argv[])
 {
+	// Checks every skin cache update against the CPU, see validateSkinCache.
+	bool validate_skinning = argc >= 3 && std::string(argv[argc - 1]) == "--validate-skinning";
+	if (validate_skinning)
+		argc--;
 	if (argc < 2) {
 		std::cerr << "Input model file is missing" << std::endl;
-		std::cerr << "Usage: " << argv[0] << " <PMD file>" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " <PMD file> [animation json] [--validate-skinning]" << std::endl;
+		std::cerr << "       " << argv[0] << " <PMD file> <animation json> --export <prefix> [fps]" << std::endl;
 		return -1;
 	}
+	if (argc >= 5 && std::string(argv[3]) == "--export") {
+		float fps = argc >= 6 ? std::stof(argv[5]) : 30.0f;
+		return exportAnimation(argv[1], argv[2], argv[4], fps);
+	}
 	GLFWwindow *window = init_glefw();
 	GUI gui(window, main_view_width, main_view_height, timeline_height, preview_height);
 
@@ -284,36 +454,28 @@ int main(int argc, char* argv[])
 	 * Note: lambda expressions cannot be converted to std::function directly
 	 *       Hence we need to declare the data function explicitly.
 	 *
-	 * CAVEAT: DO NOT RETURN const T&, which compiles but causes
-	 *         segfaults.
-	 *
-	 * Do not worry about the efficient issue, copy elision in C++ 17 will
-	 * minimize the performance impact.
+	 * CAVEAT: DO NOT RETURN const T& from a lambda without spelling out
+	 *         the return type ( -> const T& ). Otherwise the lambda
+	 *         returns a copy and std::function hands out a dangling
+	 *         reference, which compiles but causes segfaults.
 	 *
-	 * More details about copy elision:
-	 *      https://en.cppreference.com/w/cpp/language/copy_elision
+	 * Small values are fine to return by value, they are compared with the
+	 * last one and only uploaded to programs that do not have them yet.
+	 * Arrays go through make_uniform_view, which binds them in place, and
+	 * values that never change through make_constant_uniform.
 	 */
 
 	// FIXME: add more lambdas for data_source if you want to use RenderPass.
 	//        Otherwise, do whatever you like here
-	std::function<const glm::mat4*()> model_data = [&mats]() {
-		return mats.model;
-	};
-	std::function<glm::mat4()> view_data = [&mats]() { return *mats.view; };
-	std::function<glm::mat4()> proj_data = [&mats]() { return *mats.projection; };
-	std::function<glm::mat4()> identity_mat = [](){ return glm::mat4(1.0f); };
-	std::function<glm::vec3()> cam_data = [&gui](){ return gui.getCamera(); };
+	std::function<glm::mat4()> model_data = [&mats]() { return *mats.model; };
 	std::function<glm::vec4()> lp_data = [&gui]() { return gui.getLightPosition(); };
-	std::function<glm::vec4()> lc_data = [&gui]() { return gui.getLightColor(); };
 
 
-	auto std_model = std::make_shared<ShaderUniform<const glm::mat4*>>("model", model_data);
-	auto floor_model = make_uniform("model", identity_mat);
-	auto std_view = make_uniform("view", view_data);
-	auto std_camera = make_uniform("camera_position", cam_data);
-	auto std_proj = make_uniform("projection", proj_data);
-	auto std_light = make_uniform("light_position", lp_data);
-	auto std_color = make_uniform("light_color", lc_data);
+	auto std_model = make_uniform("model", model_data);
+	auto floor_model = make_constant_uniform("model", glm::mat4(1.0f));
+	// view, projection, camera and light live in the FrameConstants block
+	// that every program shares, see frame_constants.h
+	FrameConstantsBuffer frame_constants;
 
 	std::function<float()> alpha_data = [&gui]() {
 		static const float transparet = 0.5; // Alpha constant goes here
@@ -325,10 +487,9 @@ int main(int argc, char* argv[])
 	};
 	auto object_alpha = make_uniform("alpha", alpha_data);
 
-	std::function<std::vector<glm::vec3>()> trans_data = [&mesh](){ return mesh.getCurrentQ()->transData(); };
-	std::function<std::vector<glm::fquat>()> rot_data = [&mesh](){ return mesh.getCurrentQ()->rotData(); };
-	auto joint_trans = make_uniform("joint_trans", trans_data);
-	auto joint_rot = make_uniform("joint_rot", rot_data);
+	// Every skinning program samples the same palette buffer.
+	auto palette_sampler = make_constant_uniform("palette", kPaletteTextureUnit);
+	auto dq_palette_sampler = make_constant_uniform("dq_palette", kDualQuaternionTextureUnit);
 	// FIXME: define more ShaderUniforms for RenderPass if you want to use it.
 	//        Otherwise, do whatever you like here
 	std::function<glm::mat4()> bone_transform = [&gui](){ return gui.boneTransform(); };
@@ -338,8 +499,13 @@ int main(int argc, char* argv[])
 	std::function<glm::mat4()> light_transform = [&gui](){ return gui.lightTransform(); };
 	auto light_trans = make_uniform("bone_transform", light_transform);
 
-	std::function<vector<glm::mat4>()> d_u_matrix  = [&mesh](){ return mesh.load_d_u(); };
-	auto blend_d_u = make_uniform("blend_d_u", d_u_matrix);
+	PaletteBuffer palette;
+	palette.resize(mesh.getNumberOfBones(), sizeof(glm::mat4));
+	PaletteBuffer dq_palette;
+	dq_palette.resize(mesh.getNumberOfBones(), sizeof(glm::mat2x4));
+	// mat4 palette entries not uploaded yet while skinning with dual
+	// quaternions, only the bone pass needs them then
+	SlotRange pending_matrices;
 
 	// std::function<vector<glm::mat4>()> d_matrix  = [&mesh](){ return mesh.load_d(); };
 	// auto blend_d = make_uniform("blend_d", d_matrix);
@@ -353,63 +519,149 @@ int main(int argc, char* argv[])
 	RenderPass floor_pass(-1,
 			floor_pass_input,
 			{ vertex_shader, geometry_shader, floor_fragment_shader},
-			{ floor_model, std_view, std_proj, std_light },
+			{ floor_model },
+			{ "fragment_color" }
+			);
+	RenderPass floor_flat_pass(floor_pass,
+			{ flat_vertex_shader, nullptr, floor_fragment_shader},
+			{ floor_model },
 			{ "fragment_color" }
 			);
 
 	// PMD Model render pass
-	// FIXME: initialize the input data at Mesh::loadPmd
-	std::vector<glm::vec2>& uv_coordinates = mesh.uv_coordinates;
+	// All skinning attributes live in one compact interleaved buffer.
+	PackedSkinnedVertices packed_vertices;
+	packed_vertices.build(mesh);
 	RenderDataInput object_pass_input;
-	object_pass_input.assign(0, "jid0", mesh.joint0.data(), mesh.joint0.size(), 1, GL_INT);
-	object_pass_input.assign(1, "jid1", mesh.joint1.data(), mesh.joint1.size(), 1, GL_INT);
-	object_pass_input.assign(2, "w0", mesh.weight_for_joint0.data(), mesh.weight_for_joint0.size(), 1, GL_FLOAT);
-	object_pass_input.assign(3, "vector_from_joint0", mesh.vector_from_joint0.data(), mesh.vector_from_joint0.size(), 3, GL_FLOAT);
-	object_pass_input.assign(4, "vector_from_joint1", mesh.vector_from_joint1.data(), mesh.vector_from_joint1.size(), 3, GL_FLOAT);
-	object_pass_input.assign(5, "normal", mesh.vertex_normals.data(), mesh.vertex_normals.size(), 4, GL_FLOAT);
-	object_pass_input.assign(6, "uv", uv_coordinates.data(), uv_coordinates.size(), 2, GL_FLOAT);
-
-	// TIPS: You won't need vertex position in your solution.
-	//       This only serves the stub shader.
-	object_pass_input.assign(7, "vert", mesh.vertices.data(), mesh.vertices.size(), 4, GL_FLOAT);
+	packed_vertices.assign(object_pass_input);
+	// Two influence models keep the cheaper skin() and vertex layout.
+	bool four_influences = packed_vertices.hasFourInfluences();
+	std::string skin_lbs = std::string(skinning_header)
+	                     + (four_influences ? skin_lbs4_source : skin_lbs_source);
+	std::string skin_dq = std::string(skinning_header)
+	                    + (four_influences ? skin_dq4_source : skin_dq_source);
+	std::string blending_shader = skin_lbs + blending_main;
+	std::string blending_dq_shader = skin_dq + blending_main;
+	std::string skinned_shader = skin_lbs + skinned_main;
+	std::string skinned_dq_shader = skin_dq + skinned_main;
+	std::string skin_feedback_shader = skin_lbs + skin_feedback_main;
+	std::string skin_feedback_dq_shader = skin_dq + skin_feedback_main;
 	object_pass_input.assignIndex(mesh.faces.data(), mesh.faces.size(), 3);
 	object_pass_input.useMaterials(mesh.materials);
 	//cout << " OBJECT PASS" << endl;
 	RenderPass object_pass(-1,
 			object_pass_input,
 			{
-			  blending_shader,
+			  blending_shader.c_str(),
 			  geometry_shader,
 			  fragment_shader
 			},
-			{ std_model, std_view, std_proj,
-			  std_light,
-			  std_camera, object_alpha,
-			  joint_trans, joint_rot,
-			  blend_d_u, std_color
+			{ std_model, object_alpha, palette_sampler
 			},
 			{ "fragment_color" }
 			);
 
+	// Same data and materials, dual quaternion skinning.
+	RenderPass object_dq_pass(object_pass,
+			{
+			  blending_dq_shader.c_str(),
+			  geometry_shader,
+			  fragment_shader
+			},
+			{ std_model, object_alpha, dq_palette_sampler
+			},
+			{ "fragment_color" }
+			);
+
+	// Without the geometry shader, the vertex shader projects and
+	// default.frag only needs the interpolated vertex normal.
+	RenderPass object_flat_pass(object_pass,
+			{ skinned_shader.c_str(), nullptr, fragment_shader },
+			{ std_model, object_alpha, palette_sampler
+			},
+			{ "fragment_color" }
+			);
+	RenderPass object_dq_flat_pass(object_pass,
+			{ skinned_dq_shader.c_str(), nullptr, fragment_shader },
+			{ std_model, object_alpha, dq_palette_sampler
+			},
+			{ "fragment_color" }
+			);
+
+	// Optional skin once stage: the feedback passes or the compute
+	// skinner write the skinned mesh into skin_cache, the cached passes
+	// draw it as static geometry.
+	std::vector<const char*> skin_varyings(SkinCache::kVaryings,
+			SkinCache::kVaryings + SkinCache::kNumVaryings);
+	RenderPass skin_feedback_pass(object_pass,
+			{ skin_feedback_shader.c_str(), nullptr, nullptr },
+			{ palette_sampler },
+			{},
+			skin_varyings
+			);
+	RenderPass skin_feedback_dq_pass(object_pass,
+			{ skin_feedback_dq_shader.c_str(), nullptr, nullptr },
+			{ dq_palette_sampler },
+			{},
+			skin_varyings
+			);
+	ComputeSkinner compute_skinner(skin_compute_shader);
+	compute_skinner.setBindPose(packed_vertices);
+	SkinCache skin_cache;
+	skin_cache.resize(packed_vertices.size());
+	bool skin_cache_valid = false;
+
+	RenderDataInput cached_pass_input;
+	cached_pass_input.assignBuffer(0, "skinned_position", skin_cache.getBuffer(),
+			skin_cache.size(), SkinCache::kStride, SkinCache::kPositionOffset, 3, GL_FLOAT);
+	cached_pass_input.assignBuffer(1, "skinned_normal", skin_cache.getBuffer(),
+			skin_cache.size(), SkinCache::kStride, SkinCache::kNormalOffset, 3, GL_FLOAT);
+	cached_pass_input.assignBuffer(2, "uv", skin_cache.getBuffer(),
+			skin_cache.size(), SkinCache::kStride, SkinCache::kUvOffset, 2, GL_FLOAT);
+	cached_pass_input.assignIndex(mesh.faces.data(), mesh.faces.size(), 3);
+	cached_pass_input.useMaterials(mesh.materials);
+	RenderPass cached_pass(-1,
+			cached_pass_input,
+			{ cached_shader, geometry_shader, fragment_shader },
+			{ std_model, object_alpha
+			},
+			{ "fragment_color" }
+			);
+	RenderPass cached_flat_pass(cached_pass,
+			{ cached_flat_shader, nullptr, fragment_shader },
+			{ std_model, object_alpha
+			},
+			{ "fragment_color" }
+			);
+
+	// GPU time of the floor and model, printed to compare both pipelines.
+	GpuTimer scene_timer;
+	bool timed_geometry_shader = true;
+
 	// Setup the render pass for drawing bones
 	// FIXME: You won't see the bones until Skeleton::joints were properly
 	//        initialized
+	// One vertex per palette slot, placed by its skinning matrix.
 	std::vector<int> bone_vertex_id;
+	std::vector<glm::vec3> bone_bind_position;
 	std::vector<glm::uvec2> bone_indices;
 	for (int i = 0; i < (int)mesh.skeleton.joints.size(); i++) {
 		bone_vertex_id.emplace_back(i);
+		bone_bind_position.emplace_back(mesh.skeleton.joints[mesh.skeleton.jointAt(i)].init_position);
 	}
 	for (const auto& joint: mesh.skeleton.joints) {
 		if (joint.parent_index < 0)
 			continue;
-		bone_indices.emplace_back(joint.joint_index, joint.parent_index);
+		bone_indices.emplace_back(mesh.skeleton.slotOf(joint.joint_index),
+		                          mesh.skeleton.slotOf(joint.parent_index));
 	}
 	RenderDataInput bone_pass_input;
 	bone_pass_input.assign(0, "jid", bone_vertex_id.data(), bone_vertex_id.size(), 1, GL_UNSIGNED_INT);
+	bone_pass_input.assign(1, "bind_position", bone_bind_position.data(), bone_bind_position.size(), 3, GL_FLOAT);
 	bone_pass_input.assignIndex(bone_indices.data(), bone_indices.size(), 2);
 	RenderPass bone_pass(-1, bone_pass_input,
 			{ bone_vertex_shader, nullptr, bone_fragment_shader},
-			{ std_model, std_view, std_proj, joint_trans },
+			{ std_model, palette_sampler },
 			{ "fragment_color" }
 			);
 
@@ -423,7 +675,7 @@ int main(int argc, char* argv[])
 
 	RenderPass cylinder_pass(-1, cylinder_pass_input,
 		{ cylinder_vertex_shader, nullptr, cylinder_fragment_shader},
-		{ std_model, std_view, std_proj, bone_trans},
+		{ std_model, bone_trans},
 		{ "fragment_color" }
 		);
 
@@ -434,7 +686,7 @@ int main(int argc, char* argv[])
 
 	RenderPass axes_pass(-1, axes_pass_input,
 		{ axes_vertex_shader, nullptr, axes_fragment_shader},
-		{ std_model, std_view, std_proj, bone_trans},
+		{ std_model, bone_trans},
 		{ "fragment_color" }
 		);
 
@@ -446,10 +698,74 @@ int main(int argc, char* argv[])
 
 	RenderPass light_axes_pass(-1, light_axes_pass_input,
 		{ axes_vertex_shader, nullptr, axes_fragment_shader},
-		{ std_model, std_view, std_proj, light_trans},
+		{ std_model, light_trans},
 		{ "fragment_color" }
 		);
 
+	// ID buffer picking: the model, the bones and the light tag their
+	// primitives with IDs instead of shading them.
+	IdPicker id_picker;
+	id_picker.resize(main_view_width, main_view_height);
+	auto triangle_id = make_constant_uniform("object_id", IdPicker::baseId(IdPicker::kTriangle));
+	auto bone_id = make_constant_uniform("object_id", IdPicker::baseId(IdPicker::kBone));
+	// The light's axes are IDs x_axis..y_axis of kLight, the sphere comes
+	// after them and drags nothing.
+	auto light_axes_id = make_constant_uniform("object_id", IdPicker::baseId(IdPicker::kLight));
+	auto light_id = make_constant_uniform("object_id", IdPicker::baseId(IdPicker::kLight) + GUI::none);
+	auto bone_radius = make_constant_uniform("bone_radius", kCylinderRadius);
+	auto light_offset = make_uniform("offset", lp_data);
+
+	RenderPass object_id_pass(object_pass,
+			{ skinned_shader.c_str(), nullptr, id_fragment_shader },
+			{ std_model, palette_sampler, triangle_id },
+			{ "fragment_id" }
+			);
+	RenderPass object_dq_id_pass(object_pass,
+			{ skinned_dq_shader.c_str(), nullptr, id_fragment_shader },
+			{ std_model, dq_palette_sampler, triangle_id },
+			{ "fragment_id" }
+			);
+	RenderPass cached_id_pass(cached_pass,
+			{ cached_flat_shader, nullptr, id_fragment_shader },
+			{ std_model, triangle_id },
+			{ "fragment_id" }
+			);
+	RenderPass bone_id_pass(bone_pass,
+			{ bone_id_vertex_shader, bone_id_geometry_shader, id_fragment_shader },
+			{ std_model, palette_sampler, bone_radius, bone_id },
+			{ "fragment_id" }
+			);
+	RenderDataInput light_id_input;
+	light_id_input.assign(0, "vertex_position", light_vertices.data(), light_vertices.size(), 4, GL_FLOAT);
+	light_id_input.assignIndex(light_faces.data(), light_faces.size(), 3);
+	RenderPass light_id_pass(-1, light_id_input,
+			{ light_vertex_shader, nullptr, id_fragment_shader },
+			{ light_offset, light_id },
+			{ "fragment_id" }
+			);
+	// One line per axis of light_axes_mesh, with its own end points so
+	// that both carry the axis, widened like the bones.
+	const int light_axis_of_line[] = { GUI::x_axis, GUI::z_axis, GUI::y_axis };
+	std::vector<glm::vec4> light_axes_id_vertices;
+	std::vector<int> light_axes_id_axis;
+	std::vector<glm::uvec2> light_axes_id_indices;
+	for (size_t i = 0; i < light_axes_mesh.indices.size(); i++) {
+		for (int end = 0; end < 2; end++) {
+			light_axes_id_vertices.emplace_back(light_axes_mesh.vertices[light_axes_mesh.indices[i][end]]);
+			light_axes_id_axis.emplace_back(light_axis_of_line[i]);
+		}
+		light_axes_id_indices.emplace_back(2 * i, 2 * i + 1);
+	}
+	RenderDataInput light_axes_id_input;
+	light_axes_id_input.assign(0, "vertex_position", light_axes_id_vertices.data(), light_axes_id_vertices.size(), 4, GL_FLOAT);
+	light_axes_id_input.assign(1, "axis", light_axes_id_axis.data(), light_axes_id_axis.size(), 1, GL_INT);
+	light_axes_id_input.assignIndex(light_axes_id_indices.data(), light_axes_id_indices.size(), 2);
+	RenderPass light_axes_id_pass(-1, light_axes_id_input,
+			{ light_axes_id_vertex_shader, bone_id_geometry_shader, id_fragment_shader },
+			{ std_model, light_trans, bone_radius, light_axes_id },
+			{ "fragment_id" }
+			);
+
 
 	//QUAD SETUP
 	GLuint quad_vertex_shader_id = 0;
@@ -465,7 +781,7 @@ int main(int argc, char* argv[])
 	CHECK_GL_SHADER_ERROR(quad_fragment_shader_id);
 	//generate vaos!!!
 	CHECK_GL_ERROR(glGenVertexArrays(kNumVaos, &g_array_objects[0]));
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kQuadVao]));
+	GLState::bindVertexArray(g_array_objects[kQuadVao]);
 
 
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kQuadVao][0]));
@@ -518,7 +834,7 @@ int main(int argc, char* argv[])
 	glCompileShader(select_fragment_shader_id);
 	CHECK_GL_SHADER_ERROR(select_fragment_shader_id);
 
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kSelectVao]));
+	GLState::bindVertexArray(g_array_objects[kSelectVao]);
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kSelectVao][0]));
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kSelectVao][kVertexBuffer]));
 
@@ -573,7 +889,7 @@ int main(int argc, char* argv[])
 	glCompileShader(light_fragment_shader_id);
 	CHECK_GL_SHADER_ERROR(light_fragment_shader_id);
 
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kLightVao]));
+	GLState::bindVertexArray(g_array_objects[kLightVao]);
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kLightVao][0]));
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kLightVao][kVertexBuffer]));
 
@@ -591,8 +907,6 @@ int main(int argc, char* argv[])
 
 	GLuint light_program_id = 0;
 
-	GLint light_projection_location = 0;
-	GLint light_view_location = 0;
 	GLint light_offset_location = 0;
 	GLint light_selected_location = 0;
 	GLint light_color_location = 0;
@@ -608,10 +922,7 @@ int main(int argc, char* argv[])
 	glLinkProgram(light_program_id);
 	CHECK_GL_PROGRAM_ERROR(light_program_id);
 
-	CHECK_GL_ERROR(light_projection_location =
-		glGetUniformLocation(light_program_id, "projection"));
-	CHECK_GL_ERROR(light_view_location =
-		glGetUniformLocation(light_program_id, "view"));
+	FrameConstantsBuffer::bindBlock(light_program_id);
 	CHECK_GL_ERROR(light_offset_location =
 		glGetUniformLocation(light_program_id, "offset"));
 	CHECK_GL_ERROR(light_selected_location =
@@ -626,7 +937,7 @@ int main(int argc, char* argv[])
 	glCompileShader(timeline_fragment_shader_id);
 	CHECK_GL_SHADER_ERROR(timeline_fragment_shader_id);
 
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kTimelineVao]));
+	GLState::bindVertexArray(g_array_objects[kTimelineVao]);
 
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kTimelineVao][0]));
 
@@ -676,7 +987,7 @@ int main(int argc, char* argv[])
 	{	
 		
 		glGenTextures(1, &timeline_texture);
-		glBindTexture(GL_TEXTURE_2D, timeline_texture);  
+		GLState::bindTexture(0, GL_TEXTURE_2D, timeline_texture);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 	} else {
@@ -697,7 +1008,7 @@ int main(int argc, char* argv[])
 	glCompileShader(scrub_fragment_shader_id);
 	CHECK_GL_SHADER_ERROR(scrub_fragment_shader_id);
 
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kScrubVao]));
+	GLState::bindVertexArray(g_array_objects[kScrubVao]);
 
 
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kScrubVao][0]));
@@ -747,7 +1058,7 @@ int main(int argc, char* argv[])
 	glCompileShader(box_fragment_shader_id);
 	CHECK_GL_SHADER_ERROR(box_fragment_shader_id);
 
-	CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kBoxVao]));
+	GLState::bindVertexArray(g_array_objects[kBoxVao]);
 
 
 	CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[kBoxVao][0]));
@@ -765,10 +1076,30 @@ int main(int argc, char* argv[])
 				sizeof(uint32_t) * box_faces.size() * 3,
 				box_faces.data(), GL_STATIC_DRAW));
 
+	// One marker per keyframe, drawn as instances of the box. The buffer
+	// is only refilled when GUI::getKeyframeVersion moves on.
+	struct TimelineMarker {
+		glm::vec2 offset;
+		glm::vec4 color;
+	};
+	GLuint box_instance_buffer = 0;
+	CHECK_GL_ERROR(glGenBuffers(1, &box_instance_buffer));
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, box_instance_buffer));
+	CHECK_GL_ERROR(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TimelineMarker),
+				(const void*)offsetof(TimelineMarker, offset)));
+	CHECK_GL_ERROR(glVertexAttribDivisor(1, 1));
+	CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+	CHECK_GL_ERROR(glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(TimelineMarker),
+				(const void*)offsetof(TimelineMarker, color)));
+	CHECK_GL_ERROR(glVertexAttribDivisor(2, 1));
+	CHECK_GL_ERROR(glEnableVertexAttribArray(2));
+	std::vector<TimelineMarker> timeline_markers;
+	std::vector<float> keyframe_times;
+	unsigned markers_version = 0;
+	bool markers_valid = false;
+
 	GLuint box_program_id = 0;
 	GLint box_ortho_location = 0;
-	GLint box_offset_location = 0;
-	GLint box_color_location = 0;
 
 
 	CHECK_GL_ERROR(box_program_id = glCreateProgram());
@@ -776,6 +1107,8 @@ int main(int argc, char* argv[])
 	CHECK_GL_ERROR(glAttachShader(box_program_id, box_fragment_shader_id));
 
 	CHECK_GL_ERROR(glBindAttribLocation(box_program_id, 0, "vertex_position"));
+	CHECK_GL_ERROR(glBindAttribLocation(box_program_id, 1, "instance_offset"));
+	CHECK_GL_ERROR(glBindAttribLocation(box_program_id, 2, "instance_color"));
 	CHECK_GL_ERROR(glBindFragDataLocation(box_program_id, 0, "fragment_color"));
 
 	glLinkProgram(box_program_id);
@@ -783,10 +1116,12 @@ int main(int argc, char* argv[])
 
 	CHECK_GL_ERROR(box_ortho_location =
 		glGetUniformLocation(box_program_id, "ortho"));
-	CHECK_GL_ERROR(box_offset_location =
-		glGetUniformLocation(box_program_id, "offset"));
-	CHECK_GL_ERROR(box_color_location =
-		glGetUniformLocation(box_program_id, "color"));
+	// The timeline projection never changes.
+	{
+		glm::mat4 box_proj = glm::ortho(-1.0f,1.0f,-1.0f,1.0f);
+		GLState::useProgram(box_program_id);
+		CHECK_GL_ERROR(glUniformMatrix4fv(box_ortho_location, 1, GL_FALSE, &box_proj[0][0]));
+	}
 
 
 
@@ -801,7 +1136,6 @@ int main(int argc, char* argv[])
 
 	if (argc >= 3) {
 		gui.loadAnimationFrom(argv[2]);
-		gui.getAnimationState()->end_keyframe = mesh.skeleton.keyframes.size()-1;
 
 	// 	//load textures
 	// 	glfwGetFramebufferSize(window, &window_width, &window_height);
@@ -905,6 +1239,7 @@ int main(int argc, char* argv[])
 	}
 
 
+	size_t frame_count = 0;
 	while (!glfwWindowShouldClose(window)) {
 		// Setup some basic window stuff.
 		glfwGetFramebufferSize(window, &window_width, &window_height);
@@ -919,6 +1254,8 @@ int main(int argc, char* argv[])
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glCullFace(GL_BACK);
 
+		GLState::beginFrame();
+		gui.processInput();
 		gui.updateMatrices();
 		mats = gui.getMatrixPointers();
 	
@@ -928,34 +1265,129 @@ int main(int argc, char* argv[])
 		std_model->bind(0);
 #endif
 		float scrub_time = gui.getPauseTime();
-		if (gui.isPlaying()) {
+		bool animating = gui.isPlaying() || gui.isScrubbing();
+		if (animating) {
 			std::stringstream title;
-			float cur_time = gui.getCurrentPlayTime();
+			if (gui.isPlaying())
+				scrub_time = gui.getCurrentPlayTime();
 			title << window_title << " Playing: "
 			      << std::setprecision(2)
 			      << std::setfill('0') << std::setw(6)
-			      << cur_time << " sec";
+			      << scrub_time << " sec";
 			glfwSetWindowTitle(window, title.str().data());
-			//pass in animation state to updateAnimation
-			//im sorry
-			scrub_time = cur_time;
-			mesh.updateAnimation(cur_time, gui.getAnimationState());
-			gui.updateScene(cur_time);
-
-		}else if (gui.isScrubbing()){
-				std::stringstream title;
-			float cur_time = gui.getPauseTime();
-			title << window_title << " Playing: "
-			      << std::setprecision(2)
-			      << std::setfill('0') << std::setw(6)
-			      << cur_time << " sec";
-			glfwSetWindowTitle(window, title.str().data());
-			mesh.updateAnimation(cur_time, gui.getAnimationState());
-			gui.updateScene(cur_time);
+		}
+
+		// Pose evaluation and palette upload must run out of the
+		// buffers preallocated by the Mesh, see the check below.
+		size_t pose_allocations = heapAllocationCount();
+		if (animating) {
+			mesh.updateAnimation(scrub_time, gui.getAnimationState());
 		} else if (gui.isPoseDirty()) {
 			mesh.updateAnimation();
 			gui.clearPose();
-		} 
+		}
+		// Upload the palette entries that changed, once for all passes.
+		bool dual_quaternion = gui.isDualQuaternion();
+		bool draw_bones = draw_skeleton && gui.isTransparent();
+		mesh.setSkinningMode(dual_quaternion ? kDualQuaternionSkinning : kLinearBlendSkinning);
+		SlotRange palette_changes = mesh.takePaletteChanges();
+		pending_matrices.merge(palette_changes);
+		if (!dual_quaternion || draw_bones) {
+			palette.update(mesh.load_d_u().data(), pending_matrices.begin, pending_matrices.end);
+			pending_matrices = SlotRange();
+		}
+		if (dual_quaternion)
+			dq_palette.update(mesh.load_dq().data(), palette_changes.begin, palette_changes.end);
+		palette.bind(kPaletteTextureUnit);
+		dq_palette.bind(kDualQuaternionTextureUnit);
+		// Skin once for all passes that draw the model, only when the
+		// pose or the skinning mode changed.
+		SkinningBackend skinning_backend = gui.getSkinningBackend();
+		if (skinning_backend == kComputeSkinning && !compute_skinner.isSupported())
+			skinning_backend = kTransformFeedbackSkinning;
+		bool skin_once = skinning_backend != kVertexShaderSkinning;
+		if (!skin_once || gui.validateSkinning())
+			skin_cache_valid = false;
+		bool skinned = false;
+		if (skin_once && draw_object && (!skin_cache_valid || !palette_changes.empty())) {
+			if (skinning_backend == kComputeSkinning) {
+				compute_skinner.dispatch(dual_quaternion ? dq_palette : palette,
+				                         mesh.getSkinningMode(), skin_cache);
+			} else {
+				RenderPass& feedback_pass = dual_quaternion ? skin_feedback_dq_pass : skin_feedback_pass;
+				feedback_pass.setup();
+				skin_cache.capture();
+			}
+			skin_cache_valid = true;
+			skinned = true;
+		}
+		pose_allocations = heapAllocationCount() - pose_allocations;
+		// off the pose path, it allocates and waits for the GPU
+		if (gui.validateSkinning() && !skin_once) {
+			std::cout << "Cannot validate skinning: the vertex shader skins without a cache" << std::endl;
+			gui.resetSkinningValidation();
+		} else if (skinned && (validate_skinning || gui.validateSkinning())) {
+			validateSkinCache(mesh, skin_cache, skinning_backend);
+			gui.resetSkinningValidation();
+		}
+		if (animating)
+			gui.updateScene(scrub_time);
+		// once the scene moved camera and light for this frame
+		FrameConstants frame;
+		frame.view = *mats.view;
+		frame.projection = *mats.projection;
+		frame.light_position = gui.getLightPosition();
+		frame.light_color = gui.getLightColor();
+		frame.camera_position = gui.getCamera();
+		frame_constants.update(frame);
+
+		// Hover picking from the ID buffer. The result read here was
+		// queued a frame or two ago, this frame's is read later on.
+		if (gui.useGpuPicking()) {
+			IdPicker::Result picked;
+			if (id_picker.poll(picked)) {
+				int joint = -1;
+				int light_axis = GUI::none;
+				if (picked.kind == IdPicker::kLight) {
+					light_axis = std::min(picked.index, int(GUI::none));
+				} else if (picked.kind == IdPicker::kBone) {
+					joint = mesh.skeleton.jointAt(picked.index);
+				} else if (picked.kind == IdPicker::kTriangle) {
+					// same rule as the surface picker, over the whole face
+					int slot = dominantSlot(mesh, picked.index, glm::vec3(1.0f / 3.0f));
+					if (slot >= 0)
+						joint = mesh.skeleton.jointAt(slot);
+				}
+				gui.setHoveredBone(joint);
+				gui.setHoveredLightAxis(light_axis);
+			}
+			id_picker.begin();
+			if (draw_object) {
+				RenderPass& id_pass = skin_once ? cached_id_pass
+				                    : dual_quaternion ? object_dq_id_pass : object_id_pass;
+				id_pass.setup();
+				CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh.faces.size() * 3,
+				                              GL_UNSIGNED_INT, 0));
+			}
+			if (draw_bones) {
+				// seen through the transparent model, as they are drawn
+				light_id_pass.setup();
+				CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, light_faces.size() * 3,
+				                              GL_UNSIGNED_INT, 0));
+				glDisable(GL_DEPTH_TEST);
+				bone_id_pass.setup();
+				CHECK_GL_ERROR(glDrawElements(GL_LINES, bone_indices.size() * 2,
+				                              GL_UNSIGNED_INT, 0));
+				// the axes are handles, over the bones
+				light_axes_id_pass.setup();
+				CHECK_GL_ERROR(glDrawElements(GL_LINES, light_axes_id_indices.size() * 2,
+				                              GL_UNSIGNED_INT, 0));
+				glEnable(GL_DEPTH_TEST);
+			}
+			glm::vec2 cursor = gui.getMousePosition();
+			id_picker.end(int(cursor.x), int(cursor.y));
+			glViewport(0, 0, main_view_width, main_view_height);
+		}
 		// FIXME: update the preview textures here
 
 		//cout<<glm::to_string(gui.getCamera())<<endl;
@@ -1055,14 +1487,10 @@ int main(int argc, char* argv[])
 			                              bone_indices.size() * 2,
 			                              GL_UNSIGNED_INT, 0));
 			//draw the light!
-			CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kLightVao]));
-			CHECK_GL_ERROR(glUseProgram(light_program_id));
+			GLState::bindVertexArray(g_array_objects[kLightVao]);
+			GLState::useProgram(light_program_id);
 
-			glm::mat4 projection = gui.getProjection();
-			const float* view = gui.getView();
 			glm::vec4 current_color = gui.getLightColor();
-			CHECK_GL_ERROR(	glUniformMatrix4fv(light_projection_location, 1, GL_FALSE, &projection[0][0]));
-			CHECK_GL_ERROR(	glUniformMatrix4fv(light_view_location, 1, GL_FALSE, view));
 			CHECK_GL_ERROR(	glUniform4fv(light_offset_location, 1, gui.getLightPositionPtr()));
 			CHECK_GL_ERROR(	glUniform4fv(light_color_location, 1, &current_color[0]));
 			CHECK_GL_ERROR(	glUniform1i(light_selected_location, gui.getOnLight()));
@@ -1086,9 +1514,17 @@ int main(int argc, char* argv[])
 			                              GL_UNSIGNED_INT, 0));
 		}
 
+		bool use_geometry_shader = gui.useGeometryShader();
+		if (use_geometry_shader != timed_geometry_shader) {
+			scene_timer.reset();
+			timed_geometry_shader = use_geometry_shader;
+		}
+		scene_timer.begin();
+
 		// Then draw floor.
 		if (draw_floor) {
-			floor_pass.setup();
+			RenderPass& plane_pass = use_geometry_shader ? floor_pass : floor_flat_pass;
+			plane_pass.setup();
 			// Draw our triangles.
 			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
 			                              floor_faces.size() * 3,
@@ -1097,16 +1533,29 @@ int main(int argc, char* argv[])
 	
 		//Draw the model
 		if (draw_object) {
-			object_pass.setup();
-			int mid = 0;
-			while (object_pass.renderWithMaterial(mid))
-				mid++;
+			RenderPass& skin_pass = skin_once
+			                      ? (use_geometry_shader ? cached_pass : cached_flat_pass)
+			                      : use_geometry_shader
+			                      ? (dual_quaternion ? object_dq_pass : object_pass)
+			                      : (dual_quaternion ? object_dq_flat_pass : object_flat_pass);
+			size_t palette_allocations = heapAllocationCount();
+			skin_pass.setup();
+			pose_allocations += heapAllocationCount() - palette_allocations;
+			if (!skin_pass.renderMaterials()) {
 #if 0
-			// For debugging also
-			if (mid == 0) // Fallback
+				// For debugging also, fallback
 				CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh.faces.size() * 3, GL_UNSIGNED_INT, 0));
 #endif
+			}
 		}
+		scene_timer.end();
+		double scene_ms;
+		if (scene_timer.poll(scene_ms))
+			std::cerr << "Floor and model: " << scene_ms << " ms GPU ("
+			          << (use_geometry_shader ? "geometry shader" : "no geometry shader")
+			          << "), binds last frame: " << GLState::getLastFrame().issued
+			          << " issued, " << GLState::getLastFrame().elided << " elided"
+			          << std::endl;
 		
 		// glViewport(main_view_width, timeline_height, preview_width, main_view_height);
 		// vector<GLuint> texture_locs = gui.getTextureLocs();
@@ -1145,10 +1594,9 @@ int main(int argc, char* argv[])
 		glViewport(0, main_view_height, main_view_width, timeline_height);
 		glm::mat4 proj = glm::ortho(-1.0f,1.0f,-3.0f,3.0f);
 		glm::mat4 timeline_proj = glm::ortho(-1.0f,1.0f,-1.0f,1.0f);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, timeline_texture);
-		CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kTimelineVao]));
-		CHECK_GL_ERROR(glUseProgram(timeline_program_id));
+		GLState::bindTexture(0, GL_TEXTURE_2D, timeline_texture);
+		GLState::bindVertexArray(g_array_objects[kTimelineVao]);
+		GLState::useProgram(timeline_program_id);
 		
 		CHECK_GL_ERROR(	glUniformMatrix4fv(timeline_ortho_location, 1, GL_FALSE, &timeline_proj[0][0]));
 		glm::vec4 timeline_offset = glm::vec4(0, 0, 0, 0);
@@ -1157,52 +1605,37 @@ int main(int argc, char* argv[])
 		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, quad_faces.size() * 3, GL_UNSIGNED_INT, 0));
 
 		
-		vector<float> modelTimes;
-		mesh.skeleton.getSkeletonKeyframeTimes(modelTimes);
-		glm::vec4 model_color = glm::vec4(0.0, 0.0, 1.0, 1.0);
-		for (float f : modelTimes) {
-			CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kBoxVao]));
-			CHECK_GL_ERROR(glUseProgram(box_program_id));
-		
-			glm::vec2 model_offset = glm::vec2(f * 0.0452, 0.2);
-			CHECK_GL_ERROR(	glUniformMatrix4fv(box_ortho_location, 1, GL_FALSE, &timeline_proj[0][0]));
-			CHECK_GL_ERROR(	glUniform2fv(box_offset_location, 1, &model_offset[0]));
-			CHECK_GL_ERROR(	glUniform4fv(box_color_location, 1, &model_color[0]));
-			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, box_faces.size() * 3, GL_UNSIGNED_INT, 0));
-		}
-
-		vector<float> lightTimes;
-		gui.getLightKeyframeTimes(lightTimes);
-		glm::vec4 light_color = glm::vec4(1.0, 1.0, 0.0, 1.0);
-		for (float f : lightTimes) {
-			CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kBoxVao]));
-			CHECK_GL_ERROR(glUseProgram(box_program_id));
-		
-			glm::vec2 light_offset = glm::vec2(f * 0.0452, 0.8);
-
-			CHECK_GL_ERROR(	glUniformMatrix4fv(box_ortho_location, 1, GL_FALSE, &timeline_proj[0][0]));
-			CHECK_GL_ERROR(	glUniform2fv(box_offset_location, 1, &light_offset[0]));
-			CHECK_GL_ERROR(	glUniform4fv(box_color_location, 1, &light_color[0]));
-			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, box_faces.size() * 3, GL_UNSIGNED_INT, 0));
+		// Model, light and camera keyframes on their own rows, rebuilt
+		// only after an edit.
+		if (!markers_valid || markers_version != gui.getKeyframeVersion()) {
+			timeline_markers.clear();
+			auto add_markers = [&](float row, const glm::vec4& color) {
+				for (float f : keyframe_times)
+					timeline_markers.push_back({ glm::vec2(f * 0.0452, row), color });
+				keyframe_times.clear();
+			};
+			mesh.skeleton.getSkeletonKeyframeTimes(keyframe_times);
+			add_markers(0.2, glm::vec4(0.0, 0.0, 1.0, 1.0));
+			gui.getLightKeyframeTimes(keyframe_times);
+			add_markers(0.8, glm::vec4(1.0, 1.0, 0.0, 1.0));
+			gui.getCameraKeyframeTimes(keyframe_times);
+			add_markers(1.4, glm::vec4(0.5, 0.0, 1.0, 1.0));
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, box_instance_buffer));
+			CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+						sizeof(TimelineMarker) * timeline_markers.size(),
+						timeline_markers.data(), GL_DYNAMIC_DRAW));
+			markers_version = gui.getKeyframeVersion();
+			markers_valid = true;
 		}
-
-		vector<float> cameraTimes;
-		gui.getCameraKeyframeTimes(cameraTimes);
-		glm::vec4 camera_color = glm::vec4(0.5, 0.0, 1.0, 1.0);
-		for (float f : cameraTimes) {
-			CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kBoxVao]));
-			CHECK_GL_ERROR(glUseProgram(box_program_id));
-		
-			glm::vec2 camera_offset = glm::vec2(f * 0.0452, 1.4);
-
-			CHECK_GL_ERROR(	glUniformMatrix4fv(box_ortho_location, 1, GL_FALSE, &timeline_proj[0][0]));
-			CHECK_GL_ERROR(	glUniform2fv(box_offset_location, 1, &camera_offset[0]));
-			CHECK_GL_ERROR(	glUniform4fv(box_color_location, 1, &camera_color[0]));
-			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, box_faces.size() * 3, GL_UNSIGNED_INT, 0));
+		if (!timeline_markers.empty()) {
+			GLState::bindVertexArray(g_array_objects[kBoxVao]);
+			GLState::useProgram(box_program_id);
+			CHECK_GL_ERROR(glDrawElementsInstanced(GL_TRIANGLES, box_faces.size() * 3,
+						GL_UNSIGNED_INT, 0, timeline_markers.size()));
 		}
 
-		CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kScrubVao]));
-		CHECK_GL_ERROR(glUseProgram(scrub_program_id));
+		GLState::bindVertexArray(g_array_objects[kScrubVao]);
+		GLState::useProgram(scrub_program_id);
 		CHECK_GL_ERROR(	glUniformMatrix4fv(scrub_ortho_location, 1, GL_FALSE, &proj[0][0]));
 
 		CHECK_GL_ERROR(	glUniform1fv(scrub_time_location, 1, &scrub_time));
@@ -1211,6 +1644,10 @@ int main(int argc, char* argv[])
 
 		glViewport(0, 0, main_view_width, main_view_height);
 
+		// Steady state frames must not allocate on the pose path.
+		frame_count++;
+		assert(frame_count == 1 || pose_allocations == 0);
+
 		if (gui.saveScreenshot()) {
 			unsigned char* pixels = new unsigned char[window_width * window_height * 3];
 			glReadPixels(0, 0, window_width, window_height, GL_RGB, GL_UNSIGNED_BYTE,pixels);
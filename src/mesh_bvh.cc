@@ -0,0 +1,351 @@
+#include "mesh_bvh.h"
+#include "bone_geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const float kMiss = std::numeric_limits<float>::max();
+// Rays closer to parallel to a triangle than this miss it.
+const float kEpsilon = 1e-12f;
+
+// Same slab test as in bone_bvh.cc.
+bool hitBox(const glm::vec3& lo, const glm::vec3& hi,
+            const glm::vec3& origin, const glm::vec3& inv_dir, float t_max)
+{
+	float t0 = 0.0f, t1 = t_max;
+	for (int i = 0; i < 3; ++i) {
+		float near = (lo[i] - origin[i]) * inv_dir[i];
+		float far = (hi[i] - origin[i]) * inv_dir[i];
+		if (near > far)
+			std::swap(near, far);
+		t0 = std::max(t0, near);
+		t1 = std::min(t1, far);
+	}
+	return t0 <= t1;
+}
+
+/*
+ * Moller-Trumbore, p is the first corner and e1, e2 the edges leaving it.
+ * Returns kMiss if the ray does not cross the triangle in front of its
+ * origin, u and v are the weights of the second and third corner.
+ */
+#if !(defined(__SSE2__) || defined(_M_X64))
+float intersectTriangle(const glm::vec3& ro, const glm::vec3& rd,
+                        const glm::vec3& p, const glm::vec3& e1, const glm::vec3& e2,
+                        float& u, float& v)
+{
+	glm::vec3 pvec = glm::cross(rd, e2);
+	float det = glm::dot(e1, pvec);
+	if (std::abs(det) < kEpsilon)
+		return kMiss;
+	float inv_det = 1.0f / det;
+	glm::vec3 tvec = ro - p;
+	u = glm::dot(tvec, pvec) * inv_det;
+	glm::vec3 qvec = glm::cross(tvec, e1);
+	v = glm::dot(rd, qvec) * inv_det;
+	if (u < 0.0f || v < 0.0f || u + v > 1.0f)
+		return kMiss;
+	float t = glm::dot(e2, qvec) * inv_det;
+	return t > 0.0f ? t : kMiss;
+}
+#endif
+
+// Skinning influences summed over the corners of a face, each corner
+// weighted by its barycentric coordinate. At most four per corner.
+struct FaceInfluences {
+	int slots[12];
+	float weights[12];
+	int n = 0;
+
+	void add(int slot, float w) {
+		if (slot < 0 || w <= 0.0f)
+			return;
+		for (int i = 0; i < n; ++i) {
+			if (slots[i] == slot) {
+				weights[i] += w;
+				return;
+			}
+		}
+		slots[n] = slot;
+		weights[n++] = w;
+	}
+};
+
+void gatherInfluences(const Mesh& mesh, int face, const glm::vec3& barycentric,
+                      FaceInfluences& inf)
+{
+	const glm::uvec3& f = mesh.faces[face];
+	for (int c = 0; c < 3; ++c) {
+		unsigned vid = f[c];
+		float b = barycentric[c];
+		if (mesh.hasFourInfluences()) {
+			for (int k = 0; k < 4; ++k)
+				inf.add(mesh.joints4[vid][k], b * mesh.weights4[vid][k]);
+		} else if (vid < mesh.joint0.size()) {
+			float w0 = vid < mesh.weight_for_joint0.size() ? mesh.weight_for_joint0[vid] : 1.0f;
+			inf.add(mesh.joint0[vid], b * w0);
+			if (vid < mesh.joint1.size())
+				inf.add(mesh.joint1[vid], b * (1.0f - w0));
+		}
+	}
+}
+
+}
+
+void MeshBvh::build(const Mesh& mesh, const std::vector<glm::vec4>& positions)
+{
+	mesh_ = &mesh;
+	nodes_.clear();
+	packets_.clear();
+	leaf_nodes_.clear();
+	int n = int(mesh.faces.size());
+	if (n == 0 || positions.size() < mesh.vertices.size())
+		return;
+	std::vector<int> faces(n);
+	std::vector<glm::vec3> centers(n);
+	for (int i = 0; i < n; ++i) {
+		const glm::uvec3& f = mesh.faces[i];
+		faces[i] = i;
+		centers[i] = glm::vec3(positions[f[0]] + positions[f[1]] + positions[f[2]]) / 3.0f;
+	}
+	buildNode(faces, 0, n, centers);
+	changed_.assign(nodes_.size(), 1);
+	refit(positions);
+}
+
+int MeshBvh::buildNode(std::vector<int>& faces, int begin, int end,
+                       const std::vector<glm::vec3>& centers)
+{
+	int index = int(nodes_.size());
+	nodes_.emplace_back();
+	// empty, so that the first refit sees every leaf change
+	nodes_[index].lo = glm::vec3(std::numeric_limits<float>::max());
+	nodes_[index].hi = glm::vec3(-std::numeric_limits<float>::max());
+	int n = end - begin;
+	if (n <= kLeafSize) {
+		Packet p;
+		for (int k = 0; k < kLeafSize; ++k)
+			p.face[k] = k < n ? faces[begin + k] : -1;
+		nodes_[index].packet = int(packets_.size());
+		packets_.push_back(p);
+		leaf_nodes_.push_back(index);
+		return index;
+	}
+
+	// Median split along the widest axis of the centers, as in BoneBvh.
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (int i = begin; i < end; ++i) {
+		lo = glm::min(lo, centers[faces[i]]);
+		hi = glm::max(hi, centers[faces[i]]);
+	}
+	glm::vec3 extent = hi - lo;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+	                               : (extent.y > extent.z ? 1 : 2);
+	int nleaves = (n + kLeafSize - 1) / kLeafSize;
+	int mid = begin + nleaves / 2 * kLeafSize;
+	std::nth_element(faces.begin() + begin, faces.begin() + mid, faces.begin() + end,
+			[&centers, axis](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+	buildNode(faces, begin, mid, centers);
+	int right = buildNode(faces, mid, end, centers);
+	nodes_[index].right = right;
+	return index;
+}
+
+void MeshBvh::refit(const std::vector<glm::vec4>& positions)
+{
+	if (nodes_.empty() || positions.size() < mesh_->vertices.size())
+		return;
+	const std::vector<glm::uvec3>& faces = mesh_->faces;
+	int npackets = int(packets_.size());
+	// Leaves are independent, each one only writes its own packet, node
+	// and flag.
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < npackets; ++i) {
+		Packet& p = packets_[i];
+		glm::vec3 lo(std::numeric_limits<float>::max());
+		glm::vec3 hi(-std::numeric_limits<float>::max());
+		for (int k = 0; k < kLeafSize; ++k) {
+			// unused lanes repeat the first triangle
+			const glm::uvec3& f = faces[p.face[k] < 0 ? p.face[0] : p.face[k]];
+			glm::vec3 a(positions[f[0]]), b(positions[f[1]]), c(positions[f[2]]);
+			glm::vec3 e1 = b - a, e2 = c - a;
+			p.px[k] = a.x; p.py[k] = a.y; p.pz[k] = a.z;
+			p.e1x[k] = e1.x; p.e1y[k] = e1.y; p.e1z[k] = e1.z;
+			p.e2x[k] = e2.x; p.e2y[k] = e2.y; p.e2z[k] = e2.z;
+			lo = glm::min(lo, glm::min(a, glm::min(b, c)));
+			hi = glm::max(hi, glm::max(a, glm::max(b, c)));
+		}
+		Node& node = nodes_[leaf_nodes_[i]];
+		bool moved = lo != node.lo || hi != node.hi;
+		changed_[leaf_nodes_[i]] = moved;
+		if (moved) {
+			node.lo = lo;
+			node.hi = hi;
+		}
+	}
+	// Children come after their parent. A still part of the model, say the
+	// legs while posing an arm, keeps its boxes.
+	for (int i = int(nodes_.size()) - 1; i >= 0; --i) {
+		Node& node = nodes_[i];
+		if (node.packet >= 0)
+			continue;
+		changed_[i] = changed_[i + 1] || changed_[node.right];
+		if (!changed_[i])
+			continue;
+		const Node& left = nodes_[i + 1];
+		const Node& right = nodes_[node.right];
+		node.lo = glm::min(left.lo, right.lo);
+		node.hi = glm::max(left.hi, right.hi);
+	}
+}
+
+MeshHit MeshBvh::intersect(const BoneRay& ray) const
+{
+	MeshHit hit;
+	float len = glm::length(ray.direction);
+	if (nodes_.empty() || len == 0.0f)
+		return hit;
+	const glm::vec3& ro = ray.origin;
+	glm::vec3 rd = ray.direction / len;
+	glm::vec3 inv_dir(1.0f / rd.x, 1.0f / rd.y, 1.0f / rd.z);
+	float best = std::numeric_limits<float>::max();
+	float best_u = 0.0f, best_v = 0.0f;
+
+#if defined(__SSE2__) || defined(_M_X64)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 eps = _mm_set1_ps(kEpsilon);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 rdx = _mm_set1_ps(rd.x), rdy = _mm_set1_ps(rd.y), rdz = _mm_set1_ps(rd.z);
+	const __m128 rox = _mm_set1_ps(ro.x), roy = _mm_set1_ps(ro.y), roz = _mm_set1_ps(ro.z);
+#endif
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const Node& node = nodes_[index];
+		if (!hitBox(node.lo, node.hi, ro, inv_dir, best))
+			continue;
+		if (node.packet < 0) {
+			stack[top++] = node.right;
+			stack[top++] = index + 1;
+			continue;
+		}
+		const Packet& p = packets_[node.packet];
+		float t[kLeafSize], u[kLeafSize], v[kLeafSize];
+#if defined(__SSE2__) || defined(_M_X64)
+		// Four triangles per register, see intersectTriangle for the
+		// scalar version of the same math.
+		__m128 e1x = _mm_loadu_ps(p.e1x), e1y = _mm_loadu_ps(p.e1y), e1z = _mm_loadu_ps(p.e1z);
+		__m128 e2x = _mm_loadu_ps(p.e2x), e2y = _mm_loadu_ps(p.e2y), e2z = _mm_loadu_ps(p.e2z);
+#define CROSS(ox, oy, oz, x0, y0, z0, x1, y1, z1) \
+		__m128 ox = _mm_sub_ps(_mm_mul_ps(y0, z1), _mm_mul_ps(z0, y1)); \
+		__m128 oy = _mm_sub_ps(_mm_mul_ps(z0, x1), _mm_mul_ps(x0, z1)); \
+		__m128 oz = _mm_sub_ps(_mm_mul_ps(x0, y1), _mm_mul_ps(y0, x1))
+#define DOT3(x0, y0, z0, x1, y1, z1) \
+		_mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, x1), _mm_mul_ps(y0, y1)), _mm_mul_ps(z0, z1))
+		CROSS(pvx, pvy, pvz, rdx, rdy, rdz, e2x, e2y, e2z);
+		__m128 det = DOT3(e1x, e1y, e1z, pvx, pvy, pvz);
+		__m128 inv_det = _mm_div_ps(one, det);
+		__m128 tvx = _mm_sub_ps(rox, _mm_loadu_ps(p.px));
+		__m128 tvy = _mm_sub_ps(roy, _mm_loadu_ps(p.py));
+		__m128 tvz = _mm_sub_ps(roz, _mm_loadu_ps(p.pz));
+		__m128 uv = _mm_mul_ps(DOT3(tvx, tvy, tvz, pvx, pvy, pvz), inv_det);
+		CROSS(qvx, qvy, qvz, tvx, tvy, tvz, e1x, e1y, e1z);
+		__m128 vv = _mm_mul_ps(DOT3(rdx, rdy, rdz, qvx, qvy, qvz), inv_det);
+		__m128 tv = _mm_mul_ps(DOT3(e2x, e2y, e2z, qvx, qvy, qvz), inv_det);
+#undef DOT3
+#undef CROSS
+		__m128 hit_mask = _mm_cmpge_ps(_mm_and_ps(det, abs_mask), eps);
+		hit_mask = _mm_and_ps(hit_mask, _mm_cmpge_ps(uv, zero));
+		hit_mask = _mm_and_ps(hit_mask, _mm_cmpge_ps(vv, zero));
+		hit_mask = _mm_and_ps(hit_mask, _mm_cmple_ps(_mm_add_ps(uv, vv), one));
+		hit_mask = _mm_and_ps(hit_mask, _mm_cmpgt_ps(tv, zero));
+		tv = _mm_or_ps(_mm_and_ps(hit_mask, tv), _mm_andnot_ps(hit_mask, _mm_set1_ps(kMiss)));
+		_mm_storeu_ps(t, tv);
+		_mm_storeu_ps(u, uv);
+		_mm_storeu_ps(v, vv);
+#else
+		for (int k = 0; k < kLeafSize; ++k)
+			t[k] = intersectTriangle(ro, rd,
+					glm::vec3(p.px[k], p.py[k], p.pz[k]),
+					glm::vec3(p.e1x[k], p.e1y[k], p.e1z[k]),
+					glm::vec3(p.e2x[k], p.e2y[k], p.e2z[k]),
+					u[k], v[k]);
+#endif
+		for (int k = 0; k < kLeafSize; ++k) {
+			if (p.face[k] >= 0 && t[k] < best) {
+				best = t[k];
+				best_u = u[k];
+				best_v = v[k];
+				hit.face = p.face[k];
+			}
+		}
+	}
+	if (hit.face < 0)
+		return hit;
+	hit.t = best;
+	hit.position = ro + best * rd;
+	hit.barycentric = glm::vec3(1.0f - best_u - best_v, best_u, best_v);
+	interpolateWeights(hit);
+	return hit;
+}
+
+void MeshBvh::interpolateWeights(MeshHit& hit) const
+{
+	FaceInfluences inf;
+	gatherInfluences(*mesh_, hit.face, hit.barycentric, inf);
+	// the two heaviest, renormalized like Mesh::joint0/joint1
+	int first = -1, second = -1;
+	for (int i = 0; i < inf.n; ++i) {
+		if (first < 0 || inf.weights[i] > inf.weights[first]) {
+			second = first;
+			first = i;
+		} else if (second < 0 || inf.weights[i] > inf.weights[second]) {
+			second = i;
+		}
+	}
+	if (first < 0)
+		return;
+	hit.joint0 = inf.slots[first];
+	if (second < 0)
+		return;
+	hit.joint1 = inf.slots[second];
+	hit.weight_for_joint0 = inf.weights[first] / (inf.weights[first] + inf.weights[second]);
+}
+
+int dominantSlot(const Mesh& mesh, int face, const glm::vec3& barycentric)
+{
+	if (face < 0)
+		return -1;
+	FaceInfluences inf;
+	gatherInfluences(mesh, face, barycentric, inf);
+	int best = -1;
+	for (int i = 0; i < inf.n; ++i) {
+		// bones are posed about their parent, a root has none
+		int joint = mesh.skeleton.jointAt(inf.slots[i]);
+		if (mesh.skeleton.joints[joint].parent_index < 0)
+			continue;
+		if (best < 0 || inf.weights[i] > inf.weights[best])
+			best = i;
+	}
+	return best < 0 ? -1 : inf.slots[best];
+}
+
+int MeshBvh::closestVertex(const MeshHit& hit) const
+{
+	if (hit.face < 0)
+		return -1;
+	const glm::vec3& b = hit.barycentric;
+	int corner = b.x >= b.y ? (b.x >= b.z ? 0 : 2) : (b.y >= b.z ? 1 : 2);
+	return int(mesh_->faces[hit.face][corner]);
+}
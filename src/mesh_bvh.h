@@ -0,0 +1,85 @@
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "bone_bvh.h"
+
+struct Mesh;
+
+struct MeshHit {
+	int face = -1;           // index into Mesh::faces, -1 on a miss
+	float t = 0.0f;          // distance along the normalized ray direction
+	glm::vec3 position;
+	glm::vec3 barycentric;   // weights of the face's three corners
+	// Skinning influences interpolated to the hit point, palette slots
+	// like Mesh::joint0/joint1. joint1 is -1 if only one bone moves it.
+	int joint0 = -1;
+	int joint1 = -1;
+	float weight_for_joint0 = 1.0f;
+};
+
+/*
+ * Palette slot of the heaviest skinning influence at a point of a face
+ * that is not a root joint, -1 if only roots move it. barycentric weights
+ * the face's corners, (1/3, 1/3, 1/3) stands for the whole face. Both bone
+ * pickers (surface ray cast and GPU ID buffer) select with this rule.
+ */
+int dominantSlot(const Mesh& mesh, int face, const glm::vec3& barycentric);
+
+/*
+ * MeshBvh: bounding volume hierarchy over the triangles of a skinned mesh,
+ * for ray casts against the posed surface.
+ *
+ * build() lays the tree out once from a set of skinned positions (e.g.
+ * CpuSkinner::getPositions()), refit() moves the triangles to new
+ * positions and only recomputes the boxes that changed. Leaves are refit
+ * in parallel when the build has OpenMP. The layout is never rebuilt, so
+ * the tree degrades with poses far from the one it was built in; build
+ * again if that matters.
+ *
+ * Leaves hold up to four triangles in SoA form, which the SSE kernel tests
+ * against a ray at once. The mesh must outlive the tree.
+ */
+class MeshBvh {
+public:
+	void build(const Mesh& mesh, const std::vector<glm::vec4>& positions);
+	void refit(const std::vector<glm::vec4>& positions);
+
+	// Closest triangle hit by the ray in front of its origin, from either
+	// side.
+	MeshHit intersect(const BoneRay& ray) const;
+	// The corner of the hit face closest to the hit point, -1 on a miss.
+	int closestVertex(const MeshHit& hit) const;
+
+	bool empty() const { return nodes_.empty(); }
+private:
+	static const int kLeafSize = 4;
+
+	// First corner and the two edges leaving it, unused lanes have face -1.
+	struct Packet {
+		float px[kLeafSize], py[kLeafSize], pz[kLeafSize];
+		float e1x[kLeafSize], e1y[kLeafSize], e1z[kLeafSize];
+		float e2x[kLeafSize], e2y[kLeafSize], e2z[kLeafSize];
+		int face[kLeafSize];
+	};
+
+	// Same layout as BoneBvh::Node.
+	struct Node {
+		glm::vec3 lo, hi;
+		int right = -1;
+		int packet = -1;
+	};
+
+	int buildNode(std::vector<int>& faces, int begin, int end,
+	              const std::vector<glm::vec3>& centers);
+	void interpolateWeights(MeshHit& hit) const;
+
+	const Mesh* mesh_ = nullptr;
+	std::vector<Node> nodes_;
+	std::vector<Packet> packets_;
+	std::vector<int> leaf_nodes_;  // node of each packet
+	std::vector<char> changed_;    // per node, set by the last refit
+};
+
+#endif
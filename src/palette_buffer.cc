@@ -0,0 +1,55 @@
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <iostream>
+#include "palette_buffer.h"
+#include "gl_state.h"
+
+PaletteBuffer::PaletteBuffer()
+{
+}
+
+PaletteBuffer::~PaletteBuffer()
+{
+	if (texture_) {
+		GLState::forgetTexture(texture_);
+		glDeleteTextures(1, &texture_);
+	}
+	if (buffer_)
+		glDeleteBuffers(1, &buffer_);
+}
+
+void PaletteBuffer::resize(size_t n, size_t entry_size, Format format)
+{
+	if (!buffer_) {
+		CHECK_GL_ERROR(glGenBuffers(1, &buffer_));
+		CHECK_GL_ERROR(glGenTextures(1, &texture_));
+	}
+	size_ = n;
+	entry_size_ = entry_size;
+	// An empty buffer texture is invalid, keep at least one entry.
+	size_t bytes = entry_size * (n > 0 ? n : 1);
+	CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, buffer_));
+	CHECK_GL_ERROR(glBufferData(GL_TEXTURE_BUFFER, bytes, nullptr, GL_DYNAMIC_DRAW));
+	GLState::bindTexture(0, GL_TEXTURE_BUFFER, texture_);
+	CHECK_GL_ERROR(glTexBuffer(GL_TEXTURE_BUFFER,
+	                           format == kInt ? GL_R32I : GL_RGBA32F, buffer_));
+	GLState::bindTexture(0, GL_TEXTURE_BUFFER, 0);
+	CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+}
+
+void PaletteBuffer::update(const void* entries, int begin, int end)
+{
+	if (begin >= end)
+		return;
+	CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, buffer_));
+	CHECK_GL_ERROR(glBufferSubData(GL_TEXTURE_BUFFER,
+	                               entry_size_ * begin,
+	                               entry_size_ * (end - begin),
+	                               (const char*)entries + entry_size_ * begin));
+	CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+}
+
+void PaletteBuffer::bind(unsigned texture_unit) const
+{
+	GLState::bindTexture(texture_unit, GL_TEXTURE_BUFFER, texture_);
+}
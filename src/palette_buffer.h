@@ -0,0 +1,46 @@
+#ifndef PALETTE_BUFFER_H
+#define PALETTE_BUFFER_H
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+/*
+ * PaletteBuffer: a skinning palette as a texture buffer (GL_RGBA32F, one
+ * texel per vec4 column, so four per mat4 and two per dual quaternion).
+ * Shaders read it through a samplerBuffer with texelFetch, so its size
+ * follows the model instead of a fixed uniform array, and every program
+ * bound to the same texture unit shares it. RenderPass keeps its material
+ * parameters in one as well.
+ */
+class PaletteBuffer {
+public:
+	// Texel format: kFloat4 for vec4 columns (samplerBuffer), kInt for one
+	// int per texel (isamplerBuffer).
+	enum Format {
+		kFloat4,
+		kInt,
+	};
+
+	PaletteBuffer();
+	~PaletteBuffer();
+	PaletteBuffer(const PaletteBuffer&) = delete;
+	PaletteBuffer& operator=(const PaletteBuffer&) = delete;
+
+	// Allocates storage for n entries of entry_size bytes, a multiple of
+	// the texel size. The content is undefined.
+	void resize(size_t n, size_t entry_size, Format format = kFloat4);
+	// Uploads entries [begin, end) with a single glBufferSubData.
+	void update(const void* entries, int begin, int end);
+	// Binds the buffer texture to the given texture unit.
+	void bind(unsigned texture_unit) const;
+	size_t size() const { return size_; }
+	// The GL buffer, e.g. to bind it as a shader storage buffer.
+	unsigned getBuffer() const { return buffer_; }
+private:
+	unsigned buffer_ = 0;
+	unsigned texture_ = 0;
+	size_t size_ = 0;
+	size_t entry_size_ = 0;
+};
+
+#endif
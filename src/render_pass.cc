@@ -1,10 +1,24 @@
 #include <GL/glew.h>
 #include "render_pass.h"
+#include "frame_constants.h"
+#include "gl_state.h"
+#include "palette_buffer.h"
+#include "config.h"
 #include <iostream>
 #include <debuggl.h>
 #include <map>
+#include <cassert>
+#include <algorithm>
+#include <iterator>
 #include <iostream>
 
+namespace {
+
+// Set by RenderPass itself, see initMaterialUniform and drawFaces.
+const char* kMaterialUniforms[] = { "textureSampler", "materials", "face_materials", "first_face" };
+
+}
+
 /*
  * For students:
  * 
@@ -24,8 +38,15 @@ struct RenderInputMeta {
 	size_t nelements = 0;
 	size_t element_length = 0;
 	int element_type = 0;
+	// interleaved buffers only, 0 stride means tightly packed
+	size_t stride = 0;
+	size_t offset = 0;
+	bool normalized = false;
+	// GL buffer holding the data, instead of uploading data
+	unsigned buffer = 0;
 
 	size_t getElementSize() const; // simple check: return 12 (3 * 4 bytes) for float3 
+	size_t getBufferSize() const { return nelements * (stride ? stride : getElementSize()); }
 	RenderInputMeta();
 	RenderInputMeta(int _position,
 	            const std::string& _name,
@@ -42,7 +63,11 @@ RenderInputMeta::RenderInputMeta()
 
 bool RenderInputMeta::isInteger() const
 {
-	return element_type == GL_INT || element_type == GL_UNSIGNED_INT;
+	if (normalized)
+		return false;
+	return element_type == GL_INT || element_type == GL_UNSIGNED_INT ||
+	       element_type == GL_SHORT || element_type == GL_UNSIGNED_SHORT ||
+	       element_type == GL_BYTE || element_type == GL_UNSIGNED_BYTE;
 }
 
 RenderInputMeta::RenderInputMeta(int _position,
@@ -77,56 +102,59 @@ RenderPass::RenderPass(int vao, // -1: create new VAO, otherwise use given VAO
 	if (vao_ < 0) {
 		CHECK_GL_ERROR(glGenVertexArrays(1, (GLuint*)&vao_));
 	}
-	CHECK_GL_ERROR(glBindVertexArray(vao_));
+	GLState::bindVertexArray(vao_);
 
 	// Program first
-	vs_ = compileShader(shaders[0], GL_VERTEX_SHADER);
-	gs_ = compileShader(shaders[1], GL_GEOMETRY_SHADER);
-	fs_ = compileShader(shaders[2], GL_FRAGMENT_SHADER);
-	CHECK_GL_ERROR(sp_ = glCreateProgram());
-	glAttachShader(sp_, vs_);
-	glAttachShader(sp_, fs_);
-	if (shaders[1])
-		glAttachShader(sp_, gs_);
+	createProgram(shaders);
 
 	// ... and then buffers
 	size_t nbuffer = input.getNBuffers();
 	if (input.hasIndex())
 		nbuffer++;
 	glbuffers_.resize(nbuffer);
-	CHECK_GL_ERROR(glGenBuffers(nbuffer, glbuffers_.data()));
 	for (int i = 0; i < input.getNBuffers(); i++) {
 		auto meta = input.getBufferMeta(i);
-		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
-		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				meta.getElementSize() * meta.nelements,
-				meta.data,
-				GL_STATIC_DRAW));
+		// Attributes of an interleaved buffer share one VBO.
+		int shared = -1;
+		for (int j = 0; j < i && shared < 0; j++)
+			if (input.getBufferMeta(j).data == meta.data)
+				shared = j;
+		if (meta.buffer) {
+			glbuffers_[i] = meta.buffer;
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
+		} else if (shared >= 0) {
+			glbuffers_[i] = glbuffers_[shared];
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
+		} else {
+			CHECK_GL_ERROR(glGenBuffers(1, &glbuffers_[i]));
+			CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
+			CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+					meta.getBufferSize(),
+					meta.data,
+					GL_STATIC_DRAW));
+		}
 		if (meta.isInteger()) {
 			CHECK_GL_ERROR(glVertexAttribIPointer(meta.position,
 						meta.element_length,
 						meta.element_type,
-						0, 0));
+						meta.stride, (const void*)meta.offset));
 		} else {
 			CHECK_GL_ERROR(glVertexAttribPointer(meta.position,
 						meta.element_length,
 						meta.element_type,
-						GL_FALSE, 0, 0));
+						meta.normalized ? GL_TRUE : GL_FALSE,
+						meta.stride, (const void*)meta.offset));
 		}
 		CHECK_GL_ERROR(glEnableVertexAttribArray(meta.position));
 		// ... because we need program to bind location
 		CHECK_GL_ERROR(glBindAttribLocation(sp_, meta.position, meta.name.c_str()));
 	}
-	// .. bind output position
-	for (size_t i = 0; i < output.size(); i++) {
-		CHECK_GL_ERROR(glBindFragDataLocation(sp_, i, output[i]));
-	}
 	// ... then we can link
-	glLinkProgram(sp_);
-	CHECK_GL_PROGRAM_ERROR(sp_);
+	linkProgram(output, {});
 
 	if (input.hasIndex()) {
 		auto meta = input.getIndexMeta();
+		CHECK_GL_ERROR(glGenBuffers(1, &glbuffers_.back()));
 		CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
 					glbuffers_.back()
 					));
@@ -134,62 +162,156 @@ RenderPass::RenderPass(int vao, // -1: create new VAO, otherwise use given VAO
 					meta.getElementSize() * meta.nelements,
 					meta.data, GL_STATIC_DRAW));
 	}
-	// after linking uniform locations can be determined
-	unilocs_.resize(uniforms.size());
-	for (size_t i = 0; i < uniforms.size(); i++) {
-		CHECK_GL_ERROR(unilocs_[i] = glGetUniformLocation(sp_, uniforms[i]->name.c_str()));
-		std::cerr << "Uniform " << uniforms[i]->name << " has location " << unilocs_[i] << std::endl;
-	}
 	if (input_.hasMaterial()) {
 		createMaterialTexture();
+		createMaterialBuffers();
 		initMaterialUniform();
 	}
 }
 
+RenderPass::RenderPass(const RenderPass& base,
+                       const std::vector<const char*> shaders,
+                       const std::vector<ShaderUniformPtr> uniforms,
+                       const std::vector<const char*> output,
+                       const std::vector<const char*> feedback)
+	: vao_(base.vao_), input_(base.input_), uniforms_(uniforms),
+	  matexids_(base.matexids_), sampler2d_(base.sampler2d_),
+	  batches_(base.batches_), material_buffer_(base.material_buffer_),
+	  face_material_buffer_(base.face_material_buffer_)
+{
+	// The VAO already points at the buffers of base, only the attribute
+	// names need to be bound for the new program.
+	GLState::bindVertexArray(vao_);
+	createProgram(shaders);
+	for (int i = 0; i < input_.getNBuffers(); i++) {
+		const auto& meta = input_.getBufferMeta(i);
+		CHECK_GL_ERROR(glBindAttribLocation(sp_, meta.position, meta.name.c_str()));
+	}
+	linkProgram(output, feedback);
+	if (input_.hasMaterial())
+		initMaterialUniform();
+}
+
+void RenderPass::createProgram(const std::vector<const char*>& shaders)
+{
+	vs_ = compileShader(shaders[0], GL_VERTEX_SHADER);
+	gs_ = compileShader(shaders[1], GL_GEOMETRY_SHADER);
+	fs_ = compileShader(shaders[2], GL_FRAGMENT_SHADER);
+	CHECK_GL_ERROR(sp_ = glCreateProgram());
+	glAttachShader(sp_, vs_);
+	if (shaders[2])
+		glAttachShader(sp_, fs_);
+	if (shaders[1])
+		glAttachShader(sp_, gs_);
+}
+
+void RenderPass::linkProgram(const std::vector<const char*>& output,
+                             const std::vector<const char*>& feedback)
+{
+	// .. bind output position
+	for (size_t i = 0; i < output.size(); i++) {
+		CHECK_GL_ERROR(glBindFragDataLocation(sp_, i, output[i]));
+	}
+	if (!feedback.empty()) {
+		CHECK_GL_ERROR(glTransformFeedbackVaryings(sp_, feedback.size(),
+					feedback.data(), GL_INTERLEAVED_ATTRIBS));
+	}
+	glLinkProgram(sp_);
+	CHECK_GL_PROGRAM_ERROR(sp_);
+	FrameConstantsBuffer::bindBlock(sp_);
+
+	// After linking uniform locations can be determined. Uniforms the
+	// program does not read are dropped here, rather than evaluated and
+	// uploaded to location -1 on every setup().
+	std::vector<ShaderUniformPtr> active;
+	unilocs_.clear();
+	for (const auto& uni : uniforms_) {
+		GLint loc;
+		CHECK_GL_ERROR(loc = glGetUniformLocation(sp_, uni->name.c_str()));
+		if (loc < 0) {
+			std::cerr << "Uniform " << uni->name << " is not used, dropped" << std::endl;
+			continue;
+		}
+		std::cerr << "Uniform " << uni->name << " has location " << loc << std::endl;
+		active.push_back(uni);
+		unilocs_.push_back(loc);
+	}
+	uniforms_.swap(active);
+	// sized here so that setup() never allocates
+	unibound_.assign(uniforms_.size(), BoundUniform());
+
+	// and the other way around, uniforms nobody sets stay at 0
+	GLint nactive = 0;
+	CHECK_GL_ERROR(glGetProgramiv(sp_, GL_ACTIVE_UNIFORMS, &nactive));
+	for (GLint i = 0; i < nactive; i++) {
+		char name[256];
+		GLint size;
+		GLenum type;
+		CHECK_GL_ERROR(glGetActiveUniform(sp_, i, sizeof(name), nullptr, &size, &type, name));
+		std::string bare(name);
+		bare = bare.substr(0, bare.find('['));
+		// members of uniform blocks have no location of their own
+		if (glGetUniformLocation(sp_, name) < 0)
+			continue;
+		bool set = std::any_of(uniforms_.begin(), uniforms_.end(),
+				[&bare](const ShaderUniformPtr& uni) { return uni->name == bare; });
+		if (input_.hasMaterial())
+			set = set || std::find(std::begin(kMaterialUniforms), std::end(kMaterialUniforms), bare)
+			             != std::end(kMaterialUniforms);
+		if (!set)
+			std::cerr << "Uniform " << bare << " is read but never set" << std::endl;
+	}
+}
+
 void RenderPass::initMaterialUniform()
 {
-	material_uniforms_.clear();
-	for (size_t i = 0; i < input_.getNMaterials(); i++) {
-		auto& ma = input_.getMaterial(i);
-		using V4F = std::function<glm::vec4 ()>;
-		using IF = std::function<int()>;
-		using FF = std::function<float()>;
-		V4F diffuse_data = [&ma]() {
-			return ma.diffuse;
-		};
-		V4F ambient_data = [&ma]() {
-			return ma.ambient;
-		};
-		V4F specular_data = [&ma]() {
-			return ma.specular;
-		};
-		FF shininess_data = [&ma]() {
-			return ma.shininess;
-		};
-		int texid = matexids_[i];
-		int sam = sampler2d_;
-		IF texture_data = [texid]() {
-			return texid;
-		};
-		IF sampler_data = [sam]() {
-			return sam;
-		};
-		auto diffuse = make_uniform("diffuse", diffuse_data);
-		auto ambient = make_uniform("ambient", ambient_data);
-		auto specular = make_uniform("specular", specular_data);
-		auto shininess = make_uniform("shininess", shininess_data);
-		auto texture = make_texture("textureSampler", sampler_data, 0, texture_data);
-		std::vector<ShaderUniformPtr> munis =
-			{diffuse, ambient, specular, shininess, texture};
-		material_uniforms_.emplace_back(munis);
+	// The samplers never move, only first_face changes between draws.
+	// Programs without these uniforms (e.g. the ID passes) get -1 here,
+	// which glUniform ignores.
+	GLState::useProgram(sp_);
+	CHECK_GL_ERROR(glUniform1i(glGetUniformLocation(sp_, "textureSampler"), 0));
+	CHECK_GL_ERROR(glUniform1i(glGetUniformLocation(sp_, "materials"), kMaterialTextureUnit));
+	CHECK_GL_ERROR(glUniform1i(glGetUniformLocation(sp_, "face_materials"), kFaceMaterialTextureUnit));
+	CHECK_GL_ERROR(first_face_loc_ = glGetUniformLocation(sp_, "first_face"));
+}
+
+/*
+ * Upload the Phong parameters of all materials and the material of every
+ * face, then merge consecutive materials with the same texture into
+ * batches. Mesh::groupMaterialsByTexture makes those runs as long as
+ * possible.
+ */
+void RenderPass::createMaterialBuffers()
+{
+	size_t nmaterials = input_.getNMaterials();
+	std::vector<glm::vec4> params;
+	params.reserve(nmaterials * 4);
+	size_t nfaces = input_.hasIndex() ? input_.getIndexMeta().nelements : 0;
+	std::vector<int> face_materials(nfaces, 0);
+	batches_.clear();
+	for (size_t i = 0; i < nmaterials; i++) {
+		const Material& ma = input_.getMaterial(i);
+		params.emplace_back(ma.diffuse);
+		params.emplace_back(ma.ambient);
+		params.emplace_back(ma.specular);
+		params.emplace_back(glm::vec4(ma.shininess));
+		for (size_t f = ma.offset; f < ma.offset + ma.nfaces && f < nfaces; f++)
+			face_materials[f] = int(i);
+		if (!batches_.empty() && batches_.back().texture == matexids_[i] &&
+		    batches_.back().first + batches_.back().nfaces == ma.offset) {
+			batches_.back().nfaces += ma.nfaces;
+			continue;
+		}
+		batches_.push_back({ matexids_[i], ma.offset, ma.nfaces });
 	}
-	malocs_.clear();
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "diffuse")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "ambient")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "specular")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "shininess")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "textureSampler")));
-	std::cerr << "textureSampler location: " << malocs_.back() << std::endl;
+	std::cerr << nmaterials << " materials drawn in " << batches_.size() << " batches" << std::endl;
+
+	material_buffer_ = std::make_shared<PaletteBuffer>();
+	material_buffer_->resize(nmaterials, sizeof(glm::vec4) * 4);
+	material_buffer_->update(params.data(), 0, nmaterials);
+	face_material_buffer_ = std::make_shared<PaletteBuffer>();
+	face_material_buffer_->resize(nfaces, sizeof(int), PaletteBuffer::kInt);
+	face_material_buffer_->update(face_materials.data(), 0, nfaces);
 }
 
 /*
@@ -200,9 +322,7 @@ void RenderPass::initMaterialUniform()
  */
 void RenderPass::createMaterialTexture()
 {
-	CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + 0));
 	matexids_.clear();
-	std::map<Image*, unsigned> tex2id;
 	for (size_t i = 0; i < input_.getNMaterials(); i++) {
 		auto& ma = input_.getMaterial(i);
 #if 0
@@ -212,9 +332,10 @@ void RenderPass::createMaterialTexture()
 			matexids_.emplace_back(0);
 			continue;
 		}
-		// Do not create multiple texture for the same data.
-		auto iter = tex2id.find(ma.texture.get());
-		if (iter != tex2id.end()) {
+		// Do not create multiple texture for the same data, also across
+		// passes that draw the same materials.
+		auto iter = texture_cache_.find(ma.texture.get());
+		if (iter != texture_cache_.end()) {
 			matexids_.emplace_back(iter->second);
 			continue;
 		}
@@ -236,7 +357,7 @@ void RenderPass::createMaterialTexture()
 		}
 		GLuint tex = 0;
 		CHECK_GL_ERROR(glGenTextures(1, &tex));
-		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, tex));
+		GLState::bindTexture(0, GL_TEXTURE_2D, tex);
 		CHECK_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8,
 					w,
 					h));
@@ -246,9 +367,9 @@ void RenderPass::createMaterialTexture()
 		//CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
 		std::cerr << __func__ << " load data into texture " << tex <<
 			" dim: " << w << " x " << h << std::endl;
-		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
+		GLState::bindTexture(0, GL_TEXTURE_2D, 0);
 		matexids_.emplace_back(tex);
-		tex2id[ma.texture.get()] = tex;
+		texture_cache_[ma.texture.get()] = tex;
 	}
 	CHECK_GL_ERROR(glGenSamplers(1, &sampler2d_));
 	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_WRAP_S, GL_REPEAT));
@@ -277,44 +398,75 @@ void RenderPass::updateVBO(int position, const void* data, size_t size)
 	auto meta = input_.getBufferMeta(bufferid);
 	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[bufferid]));
 	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				size * meta.getElementSize(),
+				size * (meta.stride ? meta.stride : meta.getElementSize()),
 				data, GL_STATIC_DRAW));
 }
 
 void RenderPass::setup()
 {
 	// Switch to our object VAO.
-	CHECK_GL_ERROR(glBindVertexArray(vao_));
+	GLState::bindVertexArray(vao_);
 	// Use our program.
-	CHECK_GL_ERROR(glUseProgram(sp_));
+	GLState::useProgram(sp_);
 
-	bindUniformsTo(uniforms_, unilocs_);
+	bindUniformsTo(uniforms_, unilocs_, unibound_);
 }
 
 bool RenderPass::renderWithMaterial(int mid)
 {
-	if (mid >= int(material_uniforms_.size()) || mid < 0)
+	if (mid >= int(matexids_.size()) || mid < 0)
 		return false;
 	const auto& mat = input_.getMaterial(mid);
 #if 0
 	if (!mat.texture)
 		return true;
 #endif
-	auto& matuni = material_uniforms_[mid];
-	bindUniformsTo(matuni, malocs_);
-	CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mat.nfaces * 3,
+	material_buffer_->bind(kMaterialTextureUnit);
+	face_material_buffer_->bind(kFaceMaterialTextureUnit);
+	GLState::bindSampler(0, sampler2d_);
+	drawFaces(matexids_[mid], mat.offset, mat.nfaces);
+	return true;
+}
+
+bool RenderPass::renderMaterials()
+{
+	if (batches_.empty())
+		return false;
+	material_buffer_->bind(kMaterialTextureUnit);
+	face_material_buffer_->bind(kFaceMaterialTextureUnit);
+	GLState::bindSampler(0, sampler2d_);
+	for (const auto& batch : batches_)
+		drawFaces(batch.texture, batch.first, batch.nfaces);
+	return true;
+}
+
+void RenderPass::drawFaces(unsigned texture, size_t first, size_t nfaces)
+{
+	// gl_PrimitiveID restarts at 0 with every draw call
+	GLState::bindTexture(0, GL_TEXTURE_2D, texture);
+	CHECK_GL_ERROR(glUniform1i(first_face_loc_, int(first)));
+	CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, nfaces * 3,
 	                              GL_UNSIGNED_INT,
-	                              (const void*)(mat.offset * 3 * 4)) // Offset is in bytes
+	                              (const void*)(first * 3 * 4)) // Offset is in bytes
 	              );
-	return true;
 }
 
 void RenderPass::bindUniformsTo(std::vector<ShaderUniformPtr>& uniforms,
-                                const std::vector<unsigned>& unilocs)
+                                const std::vector<unsigned>& unilocs,
+                                std::vector<BoundUniform>& bound)
 {
+	// Uniforms keep their values in the program, so only upload the ones
+	// that changed since this program last saw them. The uniform is
+	// remembered with its version.
+	assert(bound.size() == uniforms.size());
 	for (size_t i = 0; i < uniforms.size(); i++) {
 		const auto& uni = uniforms[i];
+		unsigned version = uni->getVersion();
+		if (version != 0 && bound[i].uniform == uni.get() && bound[i].version == version)
+			continue;
 		uni->bind(unilocs[i]);
+		bound[i].uniform = uni.get();
+		bound[i].version = version;
 	}
 }
 
@@ -348,6 +500,37 @@ void RenderDataInput::assign(int position,
 	meta_.emplace_back(position, name, data, nelements, element_length, element_type);
 }
 
+void RenderDataInput::assignInterleaved(int position,
+                                        const std::string& name,
+                                        const void *data,
+                                        size_t nvertices,
+                                        size_t stride,
+                                        size_t offset,
+                                        size_t element_length,
+                                        int element_type,
+                                        bool normalized)
+{
+	meta_.emplace_back(position, name, data, nvertices, element_length, element_type);
+	meta_.back().stride = stride;
+	meta_.back().offset = offset;
+	meta_.back().normalized = normalized;
+}
+
+void RenderDataInput::assignBuffer(int position,
+                                   const std::string& name,
+                                   unsigned buffer,
+                                   size_t nvertices,
+                                   size_t stride,
+                                   size_t offset,
+                                   size_t element_length,
+                                   int element_type)
+{
+	meta_.emplace_back(position, name, nullptr, nvertices, element_length, element_type);
+	meta_.back().stride = stride;
+	meta_.back().offset = offset;
+	meta_.back().buffer = buffer;
+}
+
 void RenderDataInput::assignIndex(const void *data, size_t nelements, size_t element_length)
 {
 	has_index_ = true;
@@ -382,7 +565,13 @@ size_t RenderInputMeta::getElementSize() const
 		element_size = 4;
 	else if (element_type == GL_INT)
 		element_size = 4;
+	else if (element_type == GL_SHORT || element_type == GL_UNSIGNED_SHORT ||
+	         element_type == GL_HALF_FLOAT)
+		element_size = 2;
+	else if (element_type == GL_BYTE || element_type == GL_UNSIGNED_BYTE)
+		element_size = 1;
 	return element_size * element_length;
 }
 
 std::map<const char*, unsigned> RenderPass::shader_cache_;
+std::map<const Image*, unsigned> RenderPass::texture_cache_;
@@ -16,10 +16,12 @@
 #include <vector>
 #include <map>
 #include <functional>
+#include <memory>
 #include <material.h> // header from utgraphicsutil
 #include "shader_uniform.h"
 
 struct RenderInputMeta;
+class PaletteBuffer;
 
 /*
  * RenderDataInput: describe per-vertex attribute buffers used by RenderPass
@@ -43,6 +45,38 @@ public:
 	            size_t nelements,
 	            size_t element_length,
 	            int element_type);
+	/*
+	 * assignInterleaved: assign one attribute of an interleaved vertex
+	 * buffer. Attributes with the same data pointer share one VBO.
+	 *      nvertices: number of vertices in the buffer
+	 *      stride, offset: in bytes
+	 *      element_type: any GL vertex type, e.g. GL_UNSIGNED_BYTE or
+	 *                    GL_HALF_FLOAT
+	 *      normalized: integer types are read as [0, 1] / [-1, 1]
+	 *                  floats instead of ints
+	 */
+	void assignInterleaved(int position,
+	                       const std::string& name,
+	                       const void *data,
+	                       size_t nvertices,
+	                       size_t stride,
+	                       size_t offset,
+	                       size_t element_length,
+	                       int element_type,
+	                       bool normalized = false);
+	/*
+	 * assignBuffer: like assignInterleaved, but the data already lives in
+	 * the GL buffer `buffer`, e.g. the output of transform feedback.
+	 * RenderPass neither uploads nor owns it.
+	 */
+	void assignBuffer(int position,
+	                  const std::string& name,
+	                  unsigned buffer,
+	                  size_t nvertices,
+	                  size_t stride,
+	                  size_t offset,
+	                  size_t element_length,
+	                  int element_type);
 	/*
 	 * assign_index: assign the index buffer for vertices
 	 * This will bind the data to GL_ELEMENT_ARRAY_BUFFER
@@ -88,6 +122,19 @@ public:
 	           const std::vector<ShaderUniformPtr> uniforms,
 	           const std::vector<const char*> output // Order: 0, 1, 2...
 		  );
+	/*
+	 * Variant constructor: draws the vertex data, index buffer and
+	 * material textures of base with other shaders and uniforms. These
+	 * are shared rather than copied, so base must outlive the variant.
+	 *      feedback: VS outputs captured with transform feedback, in
+	 *                GL_INTERLEAVED_ATTRIBS order. The FS may be nullptr
+	 *                then.
+	 */
+	RenderPass(const RenderPass& base,
+	           const std::vector<const char*> shaders, // Order: VS, GS, FS
+	           const std::vector<ShaderUniformPtr> uniforms,
+	           const std::vector<const char*> output,
+	           const std::vector<const char*> feedback = {});
 	~RenderPass();
 
 	unsigned getVAO() const { return unsigned(vao_); }
@@ -106,26 +153,55 @@ public:
 	 * corresponding uniforms for Phong shading.
 	 */
 	bool renderWithMaterial(int i); // return false if material id is invalid
+	/*
+	 * renderMaterials: render all materials, one draw call per run of
+	 * faces sharing a texture. The FS looks the material of a face up
+	 * from gl_PrimitiveID, so materials switch without uniform uploads.
+	 */
+	bool renderMaterials(); // return false if there are no materials
 private:
+	void createProgram(const std::vector<const char*>& shaders);
+	void linkProgram(const std::vector<const char*>& output,
+	                 const std::vector<const char*>& feedback);
 	void initMaterialUniform();
 	void createMaterialTexture();
+	void createMaterialBuffers();
+	void drawFaces(unsigned texture, size_t first, size_t nfaces);
 
 	int vao_;
 	RenderDataInput input_;
 	std::vector<ShaderUniformPtr> uniforms_;
-	std::vector<std::vector<ShaderUniformPtr>> material_uniforms_;
 
-	std::vector<unsigned> glbuffers_, unilocs_, malocs_;
+	std::vector<unsigned> glbuffers_, unilocs_;
+	// What the program holds at each location of unilocs_.
+	struct BoundUniform {
+		const ShaderUniformBase* uniform = nullptr;
+		unsigned version = 0;
+	};
+	std::vector<BoundUniform> unibound_;
 	std::vector<unsigned> gltextures_, matexids_;
 	unsigned sampler2d_;
+	// Consecutive materials with the same texture, drawn with one call.
+	struct MaterialBatch {
+		unsigned texture;
+		size_t first;   // in faces
+		size_t nfaces;
+	};
+	std::vector<MaterialBatch> batches_;
+	// Four texels per material (diffuse, ambient, specular, shininess)
+	// and one material index per face, shared with the variants.
+	std::shared_ptr<PaletteBuffer> material_buffer_, face_material_buffer_;
+	int first_face_loc_ = -1;
 	unsigned vs_ = 0, gs_ = 0, fs_ = 0;
 	unsigned sp_ = 0;
 	
 	static unsigned compileShader(const char*, int type);
 	static std::map<const char*, unsigned> shader_cache_;
+	static std::map<const Image*, unsigned> texture_cache_;
 
 	static void bindUniformsTo(std::vector<ShaderUniformPtr>& uniforms,
-	                           const std::vector<unsigned>& unilocs);
+	                           const std::vector<unsigned>& unilocs,
+	                           std::vector<BoundUniform>& bound);
 };
 
 #endif
@@ -2,6 +2,7 @@
 #include <debuggl.h>
 #include <glm/gtc/quaternion.hpp>
 #include "shader_uniform.h"
+#include "gl_state.h"
 
 void bindUniform(unsigned loc, int scalar)
 {
@@ -40,40 +41,68 @@ void bindUniform(unsigned loc, const glm::mat4* mat)
 
 void bindUniform(unsigned loc, const std::vector<float>& scalars)
 {
-	glUniform1fv(loc, scalars.size(), (const GLfloat*)scalars.data());
+	bindUniform(loc, scalars.data(), scalars.size());
 }
 
 void bindUniform(unsigned loc, const std::vector<glm::vec3>& array)
 {
-	glUniform3fv(loc, array.size(), (const GLfloat*)array.data());
+	bindUniform(loc, array.data(), array.size());
 }
 
 void bindUniform(unsigned loc, const std::vector<glm::vec4>& array)
 {
-	glUniform4fv(loc, array.size(), (const GLfloat*)array.data());
+	bindUniform(loc, array.data(), array.size());
 }
 
 void bindUniform(unsigned loc, const std::vector<glm::fquat>& array)
 {
-	glUniform4fv(loc, array.size(), (const GLfloat*)array.data());
+	bindUniform(loc, array.data(), array.size());
 }
 
 void bindUniform(unsigned loc, const std::vector<glm::mat4>& array)
 {
-	glUniformMatrix4fv(loc, array.size(), GL_FALSE, (const GLfloat*)array.data());
+	bindUniform(loc, array.data(), array.size());
 }
 
+void bindUniform(unsigned loc, const int* array, size_t count)
+{
+	glUniform1iv(loc, count, (const GLint*)array);
+}
+
+void bindUniform(unsigned loc, const float* array, size_t count)
+{
+	glUniform1fv(loc, count, (const GLfloat*)array);
+}
+
+void bindUniform(unsigned loc, const glm::vec3* array, size_t count)
+{
+	glUniform3fv(loc, count, (const GLfloat*)array);
+}
+
+void bindUniform(unsigned loc, const glm::vec4* array, size_t count)
+{
+	glUniform4fv(loc, count, (const GLfloat*)array);
+}
+
+void bindUniform(unsigned loc, const glm::fquat* array, size_t count)
+{
+	glUniform4fv(loc, count, (const GLfloat*)array);
+}
+
+void bindUniform(unsigned loc, const glm::mat4* array, size_t count)
+{
+	glUniformMatrix4fv(loc, count, GL_FALSE, (const GLfloat*)array);
+}
 
 void TextureCombo::bind(unsigned loc)
 {
 	// Assign texture object to texture unit
 	unsigned tex = texture_source();
-	CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + texture_unit));
-	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, tex));
+	GLState::bindTexture(texture_unit, GL_TEXTURE_2D, tex);
 
 	// Set the OpenGL sampler used by the texture unit
 	unsigned sam = sampler_source();
-	CHECK_GL_ERROR(glBindSampler(texture_unit, sam));
+	GLState::bindSampler(texture_unit, sam);
 
 	// Attach the GLSL sampler to a texture unit
 	CHECK_GL_ERROR(glUniform1i(loc, texture_unit));
@@ -26,11 +26,25 @@ void bindUniform(unsigned, const std::vector<glm::vec4>&);
 void bindUniform(unsigned, const std::vector<glm::fquat>&);
 void bindUniform(unsigned, const std::vector<glm::mat4>&);
 
+// Arrays of count elements, the vector overloads above forward here.
+void bindUniform(unsigned, const int*, size_t count);
+void bindUniform(unsigned, const float*, size_t count);
+void bindUniform(unsigned, const glm::vec3*, size_t count);
+void bindUniform(unsigned, const glm::vec4*, size_t count);
+void bindUniform(unsigned, const glm::fquat*, size_t count);
+void bindUniform(unsigned, const glm::mat4*, size_t count);
+
 // FIXME: overload bindUniform function to handle new data types.
 
 struct ShaderUniformBase {
 	std::string name;
 
+	/*
+	 * Changes whenever the value does, RenderPass skips the upload when
+	 * its program already holds this version. 0 means the uniform is not
+	 * tracked and is bound every time.
+	 */
+	virtual unsigned getVersion() { return 0; }
 	virtual void bind(unsigned loc) = 0;
 };
 
@@ -49,8 +63,15 @@ std::ostream& operator<<(std::ostream& stm, const std::vector<T>& obj) {
     return stm;
 }
 
+/*
+ * ShaderUniform: value returned by a function, evaluated on every bind.
+ * The last value is kept to tell whether it changed, which makes this a
+ * poor fit for arrays: use ShaderUniformView for those.
+ */
 template<typename T>
 struct ShaderUniform : public ShaderUniformBase {
+	static_assert(!std::is_pointer<T>::value,
+	              "pointers are compared instead of their data, use make_uniform_view");
 	std::function<T()> data_source;
 
 	ShaderUniform(const std::string& name,
@@ -60,10 +81,73 @@ struct ShaderUniform : public ShaderUniformBase {
 		this->data_source = func;
 	}
 
+	virtual unsigned getVersion() override
+	{
+		update();
+		return version_;
+	}
+
 	virtual void bind(unsigned loc) override
 	{
-		CHECK_GL_ERROR(bindUniform(loc, this->data_source()));
+		update();
+		CHECK_GL_ERROR(bindUniform(loc, value_));
 	};
+private:
+	void update()
+	{
+		T value = this->data_source();
+		if (version_ != 0 && value == value_)
+			return;
+		value_ = value;
+		// 0 is taken by untracked uniforms
+		if (++version_ == 0)
+			version_ = 1;
+	}
+
+	typename std::decay<T>::type value_;
+	unsigned version_ = 0;
+};
+
+/*
+ * ShaderUniformView: binds count elements straight from data, or all
+ * elements of a vector that may be resized, without copying them. The
+ * owner of the data increments *version after changing it; without a
+ * version counter the uniform is bound every time.
+ */
+template<typename T>
+struct ShaderUniformView : public ShaderUniformBase {
+	const T* data = nullptr;
+	size_t count = 0;
+	const std::vector<T>* array = nullptr;
+	const unsigned* version = nullptr;
+
+	virtual unsigned getVersion() override
+	{
+		// + 1 keeps a fresh counter at 0 apart from untracked uniforms
+		return version ? *version + 1 : 0;
+	}
+
+	virtual void bind(unsigned loc) override
+	{
+		if (array)
+			CHECK_GL_ERROR(bindUniform(loc, array->data(), array->size()));
+		else
+			CHECK_GL_ERROR(bindUniform(loc, data, count));
+	}
+};
+
+/*
+ * ShaderUniformConstant: never changes, so every program gets it once.
+ */
+template<typename T>
+struct ShaderUniformConstant : public ShaderUniformBase {
+	T value;
+
+	virtual unsigned getVersion() override { return 1; }
+	virtual void bind(unsigned loc) override
+	{
+		CHECK_GL_ERROR(bindUniform(loc, value));
+	}
 };
 
 template<typename T>
@@ -76,6 +160,44 @@ make_uniform(const std::string& name,
 	return std::make_shared<ShaderUniform<T>>(name, func);
 }
 
+template<typename T>
+std::shared_ptr<ShaderUniformBase>
+make_uniform_view(const std::string& name,
+                  const T* data,
+                  size_t count = 1,
+                  const unsigned* version = nullptr)
+{
+	auto ret = std::make_shared<ShaderUniformView<T>>();
+	ret->name = name;
+	ret->data = data;
+	ret->count = count;
+	ret->version = version;
+	return ret;
+}
+
+template<typename T>
+std::shared_ptr<ShaderUniformBase>
+make_uniform_view(const std::string& name,
+                  const std::vector<T>& array,
+                  const unsigned* version = nullptr)
+{
+	auto ret = std::make_shared<ShaderUniformView<T>>();
+	ret->name = name;
+	ret->array = &array;
+	ret->version = version;
+	return ret;
+}
+
+template<typename T>
+std::shared_ptr<ShaderUniformBase>
+make_constant_uniform(const std::string& name, const T& value)
+{
+	auto ret = std::make_shared<ShaderUniformConstant<T>>();
+	ret->name = name;
+	ret->value = value;
+	return ret;
+}
+
 struct TextureCombo : public ShaderUniformBase {
 	std::function<unsigned()> sampler_source;
 	unsigned texture_unit;
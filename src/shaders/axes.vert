@@ -1,8 +1,13 @@
 R"zzz(#version 330 core
 uniform mat4 bone_transform;
-uniform mat4 projection;
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
 uniform mat4 model;
-uniform mat4 view;
 flat out vec4 color;
 in vec4 vertex_position;
 void main() {
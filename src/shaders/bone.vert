@@ -1,13 +1,25 @@
 R"zzz(#version 330 core
-const int kMaxBones = 128;
-uniform mat4 projection;
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
 uniform mat4 model;
-uniform mat4 view;
+uniform samplerBuffer palette;
 in int jid;
-uniform vec3 joint_trans[128];
+in vec3 bind_position;
+
+mat4 paletteMatrix(int slot) {
+	return mat4(texelFetch(palette, 4 * slot),
+	            texelFetch(palette, 4 * slot + 1),
+	            texelFetch(palette, 4 * slot + 2),
+	            texelFetch(palette, 4 * slot + 3));
+}
 
 void main() {
 	mat4 mvp = projection * view * model;
-	gl_Position = mvp * vec4(joint_trans[jid], 1.0);
+	gl_Position = mvp * (paletteMatrix(jid) * vec4(bind_position, 1.0));
 }
 )zzz"
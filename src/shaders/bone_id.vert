@@ -0,0 +1,27 @@
+R"zzz(#version 330 core
+uniform mat4 model;
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
+uniform samplerBuffer palette;
+in int jid;
+in vec3 bind_position;
+flat out int vs_slot;
+
+mat4 paletteMatrix(int slot) {
+	return mat4(texelFetch(palette, 4 * slot),
+	            texelFetch(palette, 4 * slot + 1),
+	            texelFetch(palette, 4 * slot + 2),
+	            texelFetch(palette, 4 * slot + 3));
+}
+
+// Same as bone.vert, in view space for bone_id.geom.
+void main() {
+	vs_slot = jid;
+	gl_Position = view * model * (paletteMatrix(jid) * vec4(bind_position, 1.0));
+}
+)zzz"
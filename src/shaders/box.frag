@@ -1,7 +1,7 @@
 R"zzz(#version 330 core
-uniform vec4 color;
+in vec4 box_color;
 out vec4 fragment_color;
 void main() {
-	fragment_color = color;
+	fragment_color = box_color;
 }
-)zzz"
\ No newline at end of file
+)zzz"
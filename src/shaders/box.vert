@@ -1,9 +1,13 @@
 R"zzz(#version 330 core
 
 uniform mat4 ortho;
-uniform vec2 offset;
 in vec4 vertex_position;
+// One instance per keyframe marker.
+in vec2 instance_offset;
+in vec4 instance_color;
+out vec4 box_color;
 
 void main() {
-    gl_Position = ortho * (vertex_position + vec4(offset,0,0));
+    gl_Position = ortho * (vertex_position + vec4(instance_offset,0,0));
+    box_color = instance_color;
 })zzz"
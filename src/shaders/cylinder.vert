@@ -1,9 +1,14 @@
 R"zzz(#version 330 core
 uniform mat4 bone_transform; // transform the cylinder to the correct configuration
 const float kPi = 3.1415926535897932384626433832795;
-uniform mat4 projection;
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
 uniform mat4 model;
-uniform mat4 view;
 in vec4 vertex_position;
 void main() {
     vec4 cyl = vec4(cos(2*kPi*vertex_position.x), vertex_position.y, sin(2*kPi*vertex_position.x), 1);
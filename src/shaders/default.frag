@@ -5,13 +5,20 @@ in vec4 vertex_normal;
 in vec4 light_direction;
 in vec4 camera_direction;
 in vec2 uv_coords;
-uniform vec4 diffuse;
-uniform vec4 ambient;
-uniform vec4 specular;
-uniform float shininess;
 uniform float alpha;
-uniform vec4 light_color;
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
 uniform sampler2D textureSampler;
+// Four texels per material: diffuse, ambient, specular, shininess.
+uniform samplerBuffer materials;
+// Material of each face, gl_PrimitiveID counts from first_face.
+uniform isamplerBuffer face_materials;
+uniform int first_face;
 //layout(location = 0) out vec3 color;
 out vec4 fragment_color;
 
@@ -20,6 +27,11 @@ float rand(vec2 co){
     return fract(sin(dot(co.xy ,vec2(12.9898,78.233))) * 43758.5453);
 }
 void main() {
+	int material = texelFetch(face_materials, first_face + gl_PrimitiveID).r;
+	vec4 diffuse = texelFetch(materials, 4 * material);
+	vec4 ambient = texelFetch(materials, 4 * material + 1);
+	vec4 specular = texelFetch(materials, 4 * material + 2);
+	float shininess = texelFetch(materials, 4 * material + 3).x;
 	vec3 texcolor = texture(textureSampler, uv_coords).xyz;
 	if (length(texcolor) == 0.0) {
 		//vec3 color = vec3(0.0, 1.0, 0.0);
@@ -0,0 +1,21 @@
+R"zzz(
+#version 330 core
+// default.vert + default.geom for flat shaded passes, the fragment shader
+// derives the face normal from world_position.
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
+uniform mat4 model;
+in vec4 vertex_position;
+out vec4 light_direction;
+out vec4 world_position;
+void main() {
+	world_position = vertex_position;
+	light_direction = normalize(light_position - vertex_position);
+	gl_Position = projection * view * model * vertex_position;
+}
+)zzz"
@@ -1,7 +1,5 @@
 R"zzz(
 #version 330 core
-in vec4 face_normal;
-in vec4 vertex_normal;
 in vec4 light_direction;
 in vec4 world_position;
 out vec4 fragment_color;
@@ -11,7 +9,10 @@ void main() {
 	float i = floor(pos.x / check_width);
 	float j  = floor(pos.z / check_width);
 	vec3 color = mod(i + j, 2) * vec3(1.0, 1.0, 1.0);
-	float dot_nl = dot(normalize(light_direction), normalize(face_normal));
+	// flat normal from the screen space derivatives, so the floor does not
+	// need the face_normal of a geometry shader
+	vec3 face_normal = normalize(cross(dFdx(pos.xyz), dFdy(pos.xyz)));
+	float dot_nl = dot(normalize(light_direction.xyz), face_normal);
 	dot_nl = clamp(dot_nl, 0.0, 1.0);
 	color = clamp(dot_nl * color, 0.0, 1.0);
 	fragment_color = vec4(color, 1.0);
@@ -0,0 +1,8 @@
+R"zzz(#version 330 core
+// ID buffer output, see IdPicker.
+uniform int object_id;
+out uint fragment_id;
+void main() {
+	fragment_id = uint(object_id + gl_PrimitiveID);
+}
+)zzz"
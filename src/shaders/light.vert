@@ -1,6 +1,11 @@
 R"zzz(#version 330 core
-uniform mat4 projection;
-uniform mat4 view;
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
 uniform vec4 offset;
 in vec4 vertex_position;
 void main() {
@@ -0,0 +1,21 @@
+R"zzz(#version 330 core
+uniform mat4 model;
+uniform mat4 bone_transform;
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
+in vec4 vertex_position;
+in int axis;
+flat out int vs_slot;
+
+// Same as axes.vert, in view space for bone_id.geom, tagged with the GUI
+// axis the handle drags.
+void main() {
+	vs_slot = axis;
+	gl_Position = view * model * bone_transform * vertex_position;
+}
+)zzz"
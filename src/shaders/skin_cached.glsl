@@ -0,0 +1,11 @@
+R"zzz(
+// Reads the output of skin_feedback.vert, see SkinCache.
+in vec3 skinned_position;
+in vec3 skinned_normal;
+in vec2 uv;
+
+void skin(out vec4 position, out vec3 n) {
+	position = vec4(skinned_position, 1.0);
+	n = skinned_normal;
+}
+)zzz"
@@ -0,0 +1,31 @@
+R"zzz(
+in int jid0;
+in int jid1;
+in float w0;
+in vec2 normal;
+in vec2 uv;
+in vec3 vert;
+
+// Dual quaternion palette, two RGBA32F texels per bone: rotation, dual part.
+uniform samplerBuffer dq_palette;
+
+// dual quaternion blending
+void skin(out vec4 position, out vec3 skinned_normal) {
+	vec4 real = texelFetch(dq_palette, 2 * jid0);
+	vec4 dual = texelFetch(dq_palette, 2 * jid0 + 1);
+	if (w0 != 1) {
+		vec4 real1 = texelFetch(dq_palette, 2 * jid1);
+		vec4 dual1 = texelFetch(dq_palette, 2 * jid1 + 1);
+		// blend along the shorter arc
+		float w1 = dot(real, real1) < 0.0 ? w0 - 1.0 : 1.0 - w0;
+		real = w0 * real + w1 * real1;
+		dual = w0 * dual + w1 * dual1;
+	}
+	float len = length(real);
+	real /= len;
+	dual /= len;
+	vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+	position = vec4(qtransform(real, vert) + translation, 1.0);
+	skinned_normal = qtransform(real, octDecode(normal));
+}
+)zzz"
@@ -0,0 +1,33 @@
+R"zzz(
+in ivec4 joints;
+in vec4 weights;
+in vec2 normal;
+in vec2 uv;
+in vec3 vert;
+
+// Dual quaternion palette, two RGBA32F texels per bone: rotation, dual part.
+uniform samplerBuffer dq_palette;
+
+// dual quaternion blending of up to four joints
+void skin(out vec4 position, out vec3 skinned_normal) {
+	vec4 real0 = texelFetch(dq_palette, 2 * joints[0]);
+	vec4 real = weights[0] * real0;
+	vec4 dual = weights[0] * texelFetch(dq_palette, 2 * joints[0] + 1);
+	// weights are sorted, the first zero ends the used influences
+	for (int k = 1; k < 4; k++) {
+		if (weights[k] == 0.0)
+			break;
+		vec4 realk = texelFetch(dq_palette, 2 * joints[k]);
+		// blend along the shorter arc from the heaviest joint
+		float w = dot(real0, realk) < 0.0 ? -weights[k] : weights[k];
+		real += w * realk;
+		dual += w * texelFetch(dq_palette, 2 * joints[k] + 1);
+	}
+	float len = length(real);
+	real /= len;
+	dual /= len;
+	vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+	position = vec4(qtransform(real, vert) + translation, 1.0);
+	skinned_normal = qtransform(real, octDecode(normal));
+}
+)zzz"
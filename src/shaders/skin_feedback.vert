@@ -0,0 +1,13 @@
+R"zzz(
+// Captured by SkinCache::capture with transform feedback, no rasterization.
+out vec3 skinned_position;
+out vec3 skinned_normal;
+out vec2 skinned_uv;
+
+void main() {
+	vec4 position;
+	skin(position, skinned_normal);
+	skinned_position = position.xyz;
+	skinned_uv = uv;
+}
+)zzz"
@@ -0,0 +1,28 @@
+R"zzz(
+in int jid0;
+in int jid1;
+in float w0;
+in vec2 normal;
+in vec2 uv;
+in vec3 vert;
+
+// Skinning palette, one mat4 per bone as four RGBA32F texels.
+uniform samplerBuffer palette;
+
+mat4 paletteMatrix(int slot) {
+	return mat4(texelFetch(palette, 4 * slot),
+	            texelFetch(palette, 4 * slot + 1),
+	            texelFetch(palette, 4 * slot + 2),
+	            texelFetch(palette, 4 * slot + 3));
+}
+
+// linear skin blending
+void skin(out vec4 position, out vec3 skinned_normal) {
+	mat4 m = paletteMatrix(jid0);
+	if (w0 != 1)
+		m = w0 * m + (1 - w0) * paletteMatrix(jid1);
+	position = m * vec4(vert, 1.0);
+	// palette matrices are rigid, so no inverse transpose
+	skinned_normal = normalize(mat3(m) * octDecode(normal));
+}
+)zzz"
@@ -0,0 +1,31 @@
+R"zzz(
+in ivec4 joints;
+in vec4 weights;
+in vec2 normal;
+in vec2 uv;
+in vec3 vert;
+
+// Skinning palette, one mat4 per bone as four RGBA32F texels.
+uniform samplerBuffer palette;
+
+mat4 paletteMatrix(int slot) {
+	return mat4(texelFetch(palette, 4 * slot),
+	            texelFetch(palette, 4 * slot + 1),
+	            texelFetch(palette, 4 * slot + 2),
+	            texelFetch(palette, 4 * slot + 3));
+}
+
+// linear skin blending of up to four joints
+void skin(out vec4 position, out vec3 skinned_normal) {
+	mat4 m = weights[0] * paletteMatrix(joints[0]);
+	// weights are sorted, the first zero ends the used influences
+	for (int k = 1; k < 4; k++) {
+		if (weights[k] == 0.0)
+			break;
+		m += weights[k] * paletteMatrix(joints[k]);
+	}
+	position = m * vec4(vert, 1.0);
+	// palette matrices are rigid, so no inverse transpose
+	skinned_normal = normalize(mat3(m) * octDecode(normal));
+}
+)zzz"
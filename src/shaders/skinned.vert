@@ -0,0 +1,21 @@
+R"zzz(
+// Skinned vertex shader for passes without a geometry shader. It does the
+// work of default.geom itself and feeds default.frag directly.
+uniform mat4 model;
+
+out vec4 light_direction;
+out vec4 camera_direction;
+out vec4 world_position;
+out vec4 vertex_normal;
+out vec2 uv_coords;
+
+void main() {
+	vec3 n;
+	skin(world_position, n);
+	vertex_normal = vec4(n, 0.0);
+	light_direction = normalize(light_position - world_position);
+	camera_direction = normalize(vec4(camera_position, 1.0) - world_position);
+	uv_coords = uv;
+	gl_Position = projection * view * model * world_position;
+}
+)zzz"
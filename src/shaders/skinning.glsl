@@ -0,0 +1,26 @@
+R"zzz(
+#version 330 core
+// Shared head of the skinned vertex shaders. main.cc appends one of
+// skin_lbs.glsl, skin_dq.glsl or skin_cached.glsl, which declare the
+// inputs and define skin() and uv, and then one of blending.vert,
+// skinned.vert or skin_feedback.vert for main().
+layout(std140) uniform FrameConstants {
+	mat4 view;
+	mat4 projection;
+	vec4 light_position;
+	vec4 light_color;
+	vec3 camera_position;
+};
+
+// Octahedral normal, see PackedSkinnedVertices::octDecode.
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+	return normalize(n);
+}
+
+vec3 qtransform(vec4 q, vec3 v) {
+	return v + 2.0 * cross(cross(v, q.xyz) - q.w*v, q.xyz);
+}
+)zzz"
@@ -0,0 +1,59 @@
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <iostream>
+#include "skin_cache.h"
+
+const char* const SkinCache::kVaryings[] = {
+	"skinned_position",
+	"skinned_normal",
+	"skinned_uv",
+};
+
+SkinCache::SkinCache()
+{
+}
+
+SkinCache::~SkinCache()
+{
+	if (buffer_)
+		glDeleteBuffers(1, &buffer_);
+}
+
+void SkinCache::resize(size_t n)
+{
+	if (!buffer_)
+		CHECK_GL_ERROR(glGenBuffers(1, &buffer_));
+	size_ = n;
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_));
+	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, kStride * (n > 0 ? n : 1),
+	                            nullptr, GL_DYNAMIC_COPY));
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+void SkinCache::capture()
+{
+	if (size_ == 0)
+		return;
+	CHECK_GL_ERROR(glEnable(GL_RASTERIZER_DISCARD));
+	CHECK_GL_ERROR(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer_));
+	CHECK_GL_ERROR(glBeginTransformFeedback(GL_POINTS));
+	CHECK_GL_ERROR(glDrawArrays(GL_POINTS, 0, size_));
+	CHECK_GL_ERROR(glEndTransformFeedback());
+	CHECK_GL_ERROR(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0));
+	CHECK_GL_ERROR(glDisable(GL_RASTERIZER_DISCARD));
+}
+
+void SkinCache::readPositions(std::vector<glm::vec3>& positions) const
+{
+	std::vector<float> data(size_ * kStride / sizeof(float));
+	positions.resize(size_);
+	if (size_ == 0)
+		return;
+	CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, buffer_));
+	CHECK_GL_ERROR(glGetBufferSubData(GL_COPY_READ_BUFFER, 0, kStride * size_, data.data()));
+	CHECK_GL_ERROR(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+	for (size_t i = 0; i < size_; i++) {
+		const float* vertex = &data[i * kStride / sizeof(float) + kPositionOffset / sizeof(float)];
+		positions[i] = glm::vec3(vertex[0], vertex[1], vertex[2]);
+	}
+}
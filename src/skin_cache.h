@@ -0,0 +1,60 @@
+#ifndef SKIN_CACHE_H
+#define SKIN_CACHE_H
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+/*
+ * Where the model is skinned: in the vertex shader of every pass that
+ * draws it, or once per pose into a SkinCache by transform feedback or by
+ * ComputeSkinner.
+ */
+enum SkinningBackend {
+	kVertexShaderSkinning,
+	kTransformFeedbackSkinning,
+	kComputeSkinning,
+	kNumSkinningBackends
+};
+
+/*
+ * SkinCache: the skinned mesh captured with transform feedback.
+ *
+ * capture() runs the currently set up program over every vertex as points
+ * with rasterization off, the program writes the kVaryings below. Passes
+ * then read the buffer as static geometry (RenderDataInput::assignBuffer),
+ * so skinning runs once per pose instead of once per pass.
+ *
+ * Each vertex is interleaved as
+ *      skinned_position    vec3
+ *      skinned_normal      vec3
+ *      skinned_uv          vec2
+ */
+class SkinCache {
+public:
+	static const char* const kVaryings[];
+	static const int kNumVaryings = 3;
+	static const size_t kStride = 8 * sizeof(float);
+	static const size_t kPositionOffset = 0;
+	static const size_t kNormalOffset = 3 * sizeof(float);
+	static const size_t kUvOffset = 6 * sizeof(float);
+
+	SkinCache();
+	~SkinCache();
+	SkinCache(const SkinCache&) = delete;
+	SkinCache& operator=(const SkinCache&) = delete;
+
+	// Allocates room for n vertices. The content is undefined.
+	void resize(size_t n);
+	void capture();
+	// Reads the skinned positions back. Waits for the GPU, so this is for
+	// validating the skinning rather than for every frame.
+	void readPositions(std::vector<glm::vec3>& positions) const;
+	unsigned getBuffer() const { return buffer_; }
+	size_t size() const { return size_; }
+private:
+	unsigned buffer_ = 0;
+	size_t size_ = 0;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include <debuggl.h>
 #include <iostream>
 #include "texture_to_render.h"
+#include "gl_state.h"
 
 TextureToRender::TextureToRender()
 {
@@ -9,24 +10,40 @@ TextureToRender::TextureToRender()
 
 TextureToRender::~TextureToRender()
 {
-	if (fb_ < 0)
-		return ;
-	
-	unbind();
-	
-	glDeleteFramebuffers(1, &fb_);
-	glDeleteTextures(1, &tex_);
-	glDeleteRenderbuffers(1, &dep_);
-
 	release();
-	std::cout<<"Hi"<<std::endl;
 }
 
-void TextureToRender::create(int width, int height)
+void TextureToRender::create(int width, int height, Format format)
 {
+	release();
 	w_ = width;
 	h_ = height;
-	// FIXME: Create the framebuffer object backed by a texture
+	CHECK_GL_ERROR(glGenFramebuffers(1, &fb_));
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, fb_));
+
+	CHECK_GL_ERROR(glGenTextures(1, &tex_));
+	GLState::bindTexture(0, GL_TEXTURE_2D, tex_);
+	if (format == kObjectId) {
+		CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, w_, h_, 0,
+		                            GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr));
+	} else {
+		CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w_, h_, 0,
+		                            GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+	}
+	// integer textures cannot be filtered
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+	GLState::bindTexture(0, GL_TEXTURE_2D, 0);
+	CHECK_GL_ERROR(glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_, 0));
+
+	CHECK_GL_ERROR(glGenRenderbuffers(1, &dep_));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, dep_));
+	CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w_, h_));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+	CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, dep_));
+
+	GLenum draw_buffers[1] = { GL_COLOR_ATTACHMENT0 };
+	CHECK_GL_ERROR(glDrawBuffers(1, draw_buffers));
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
 		std::cerr << "Failed to create framebuffer object as render target" << std::endl;
 	} else {
@@ -37,26 +54,26 @@ void TextureToRender::create(int width, int height)
 
 void TextureToRender::bind()
 {
-	// FIXME: Unbind the framebuffer object to GL_FRAMEBUFFER
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, fb_));
+	CHECK_GL_ERROR(glViewport(0, 0, w_, h_));
 }
 
 void TextureToRender::unbind()
 {
-	// FIXME: Unbind current framebuffer object from the render target
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 }
 
 void TextureToRender::release()
 {
-	if (fb_ < 0)
+	if (fb_ == 0)
 		return ;
-	
-	unbind();
-	
+
 	glDeleteFramebuffers(1, &fb_);
+	GLState::forgetTexture(tex_);
 	glDeleteTextures(1, &tex_);
 	glDeleteRenderbuffers(1, &dep_);
 
 	fb_ = 0;
 	tex_ = 0;
 	dep_ = 0;
-}
\ No newline at end of file
+}
@@ -1,14 +1,23 @@
 #ifndef TEXTURE_TO_RENDER_H
 #define TEXTURE_TO_RENDER_H
 
+#include <utility>
+
 class TextureToRender {
 public:
+	// kColor is an RGBA8 texture, kObjectId a single unsigned integer per
+	// pixel for ID buffers.
+	enum Format { kColor, kObjectId };
+
 	TextureToRender();
 	~TextureToRender();
-	void create(int width, int height);
+	void create(int width, int height, Format format = kColor);
+	// Renders into the texture, with a viewport covering all of it.
 	void bind();
 	void unbind();
 	int getTexture() const { return tex_; }
+	int getWidth() const { return w_; }
+	int getHeight() const { return h_; }
 	TextureToRender(const TextureToRender &) = delete;
   	TextureToRender &operator=(const TextureToRender &) = delete;
 	TextureToRender(TextureToRender &&other) : w_(other.w_), h_(other.h_), fb_(other.fb_), tex_(other.tex_), dep_(other.dep_) 
@@ -25,18 +34,20 @@ public:
 		{
 			release();
 			//tex_ is now 0.
+			std::swap(w_, other.w_);
+			std::swap(h_, other.h_);
 			std::swap(fb_, other.fb_);
 			std::swap(tex_, other.tex_);
 			std::swap(dep_, other.dep_);
 		}
-		return other;
+		return *this;
 	}
 
 private:
-	int w_, h_;
-	unsigned int fb_ = -1;
-	unsigned int tex_ = -1;
-	unsigned int dep_ = -1;
+	int w_ = 0, h_ = 0;
+	unsigned int fb_ = 0;
+	unsigned int tex_ = 0;
+	unsigned int dep_ = 0;
 	void release();
 };
 
@@ -0,0 +1,134 @@
+#include <GL/glew.h>
+#include "vertex_format.h"
+#include "bone_geometry.h"
+#include "render_pass.h"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <glm/gtc/packing.hpp>
+
+namespace {
+
+// Byte offsets into a vertex, the ones after the joints depend on their
+// width and are computed in build().
+const size_t kVertOffset = 0;
+const size_t kJointOffset = 12;
+
+template <typename T>
+void put(uint8_t* dst, T value)
+{
+	std::memcpy(dst, &value, sizeof(T));
+}
+
+}
+
+glm::vec2 PackedSkinnedVertices::octEncode(const glm::vec3& n)
+{
+	float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (sum == 0.0f)
+		return glm::vec2(0.0f);
+	glm::vec2 p = glm::vec2(n.x, n.y) / sum;
+	if (n.z < 0.0f) {
+		// fold the lower hemisphere over the diagonals
+		p = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+		              (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+	}
+	return p;
+}
+
+glm::vec3 PackedSkinnedVertices::octDecode(const glm::vec2& e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+void PackedSkinnedVertices::build(const Mesh& mesh)
+{
+	nvertices_ = mesh.vertices.size();
+	wide_joints_ = mesh.getNumberOfBones() > 256;
+	ninfluences_ = mesh.hasFourInfluences() ? 4 : 2;
+	joint_size_ = wide_joints_ ? 2 : 1;
+	// keep the weights 2 byte aligned and the rest 4 byte aligned
+	weight_offset_ = kJointOffset + ninfluences_ * joint_size_;
+	size_t weight_size = ninfluences_ == 4 ? 8 : 2;
+	normal_offset_ = (weight_offset_ + weight_size + 3) & ~size_t(3);
+	uv_offset_ = normal_offset_ + 4;
+	stride_ = uv_offset_ + 4;
+
+	bytes_.assign(nvertices_ * stride_, 0);
+	for (size_t i = 0; i < nvertices_; ++i) {
+		uint8_t* v = bytes_.data() + i * stride_;
+		put(v + kVertOffset, glm::vec3(mesh.vertices[i]));
+
+		if (ninfluences_ == 4) {
+			glm::ivec4 joints = mesh.joints4[i];
+			glm::vec4 weights = mesh.weights4[i];
+			for (int k = 0; k < 4; ++k) {
+				// unused influences reuse joint 0 so the index stays valid
+				int jid = joints[k] < 0 ? joints[0] : joints[k];
+				if (wide_joints_)
+					put(v + kJointOffset + 2 * k, uint16_t(jid));
+				else
+					put(v + kJointOffset + k, uint8_t(jid));
+				put(v + weight_offset_ + 2 * k, glm::packUnorm1x16(weights[k]));
+			}
+		} else {
+			int jid0 = 0, jid1 = 0;
+			float w0 = 1.0f;
+			if (i < mesh.joint0.size()) {
+				jid0 = mesh.joint0[i];
+				// a single influence reuses joint 0 so the index stays valid
+				jid1 = mesh.joint1[i] < 0 ? jid0 : mesh.joint1[i];
+				w0 = mesh.weight_for_joint0[i];
+			}
+			if (wide_joints_) {
+				put(v + kJointOffset, uint16_t(jid0));
+				put(v + kJointOffset + 2, uint16_t(jid1));
+			} else {
+				put(v + kJointOffset, uint8_t(jid0));
+				put(v + kJointOffset + 1, uint8_t(jid1));
+			}
+			put(v + weight_offset_, glm::packUnorm1x16(w0));
+		}
+
+		glm::vec3 n = i < mesh.vertex_normals.size()
+		            ? glm::vec3(mesh.vertex_normals[i]) : glm::vec3(0.0f, 0.0f, 1.0f);
+		glm::vec2 e = octEncode(n);
+		put(v + normal_offset_, glm::packSnorm1x16(e.x));
+		put(v + normal_offset_ + 2, glm::packSnorm1x16(e.y));
+
+		glm::vec2 uv = i < mesh.uv_coordinates.size()
+		             ? mesh.uv_coordinates[i] : glm::vec2(0.0f);
+		put(v + uv_offset_, glm::packHalf1x16(uv.x));
+		put(v + uv_offset_ + 2, glm::packHalf1x16(uv.y));
+	}
+}
+
+void PackedSkinnedVertices::assign(RenderDataInput& input) const
+{
+	const void* base = bytes_.data();
+	int joint_type = wide_joints_ ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+
+	if (ninfluences_ == 4) {
+		input.assignInterleaved(0, "joints", base, nvertices_, stride_,
+		                        kJointOffset, 4, joint_type);
+		input.assignInterleaved(1, "weights", base, nvertices_, stride_,
+		                        weight_offset_, 4, GL_UNSIGNED_SHORT, true);
+	} else {
+		input.assignInterleaved(0, "jid0", base, nvertices_, stride_,
+		                        kJointOffset, 1, joint_type);
+		input.assignInterleaved(1, "jid1", base, nvertices_, stride_,
+		                        kJointOffset + joint_size_, 1, joint_type);
+		input.assignInterleaved(2, "w0", base, nvertices_, stride_,
+		                        weight_offset_, 1, GL_UNSIGNED_SHORT, true);
+	}
+	input.assignInterleaved(3, "normal", base, nvertices_, stride_,
+	                        normal_offset_, 2, GL_SHORT, true);
+	input.assignInterleaved(4, "uv", base, nvertices_, stride_,
+	                        uv_offset_, 2, GL_HALF_FLOAT);
+	input.assignInterleaved(5, "vert", base, nvertices_, stride_,
+	                        kVertOffset, 3, GL_FLOAT);
+}
@@ -0,0 +1,59 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+struct Mesh;
+class RenderDataInput;
+
+/*
+ * PackedSkinnedVertices: one interleaved vertex buffer for the skinned mesh.
+ *
+ * The PMD attributes are stored in the smallest format the shaders can
+ * read back without a visible difference:
+ *      vert    3 x float                   bind pose position
+ *      jid0/1  2 x uint8 (uint16 when the model has more than 256 bones)
+ *      w0      unorm16
+ *      normal  2 x snorm16                 octahedral encoding
+ *      uv      2 x half float
+ * which is 24 bytes per vertex (28 with 16 bit joints) instead of the
+ * 52 bytes of the separate float/int streams.
+ *
+ * Models with more than two influences per vertex (Mesh::hasFourInfluences)
+ * store all four joints and weights instead:
+ *      joints  4 x uint8 (uint16)          sorted by decreasing weight
+ *      weights 4 x unorm16                 unused influences are 0
+ * for 32 bytes per vertex (36 with 16 bit joints).
+ */
+class PackedSkinnedVertices {
+public:
+	void build(const Mesh& mesh);
+	// Assigns jid0, jid1, w0, normal, uv and vert at locations 0 to 5,
+	// or joints and weights at 0 and 1 in place of the first three.
+	void assign(RenderDataInput& input) const;
+
+	size_t size() const { return nvertices_; }
+	size_t getStride() const { return stride_; }
+	bool hasWideJoints() const { return wide_joints_; }
+	bool hasFourInfluences() const { return ninfluences_ == 4; }
+	const void* data() const { return bytes_.data(); }
+
+	// Exposed for tools that need the exact encoding.
+	static glm::vec2 octEncode(const glm::vec3& n);
+	static glm::vec3 octDecode(const glm::vec2& e);
+private:
+	size_t nvertices_ = 0;
+	size_t stride_ = 0;
+	bool wide_joints_ = false;
+	size_t ninfluences_ = 2;
+	size_t joint_size_ = 1;
+	size_t weight_offset_ = 0;
+	size_t normal_offset_ = 0;
+	size_t uv_offset_ = 0;
+	std::vector<uint8_t> bytes_;
+};
+
+#endif